@@ -19,6 +19,7 @@
  */
 
 #include "nanovna.h"
+#include <math.h>
 
 #ifdef __DUMP_CMD__
 int16_t samp_buf[SAMPLE_LEN];
@@ -44,6 +45,9 @@ static int32_t acc_samp_s;
 static int32_t acc_samp_c;
 static int32_t acc_ref_s;
 static int32_t acc_ref_c;
+#ifdef __GAIN_AUTO__
+static int32_t acc_samp_peak;
+#endif
 
 void dsp_process(int16_t *capture, size_t length)
 {
@@ -54,6 +58,9 @@ void dsp_process(int16_t *capture, size_t length)
   int32_t samp_c = 0;
   int32_t ref_s = 0;
   int32_t ref_c = 0;
+#ifdef __GAIN_AUTO__
+  int32_t peak = 0;
+#endif
 
   for (i = 0; i < len; i++) {
     uint32_t sr = *p++;
@@ -69,6 +76,12 @@ void dsp_process(int16_t *capture, size_t length)
     samp_c += smp * c / 16;
     ref_s += ref * s / 16;
     ref_c += ref * c / 16;
+#ifdef __GAIN_AUTO__
+    if (smp > peak)
+      peak = smp;
+    else if (-smp > peak)
+      peak = -smp;
+#endif
 #if 0
     uint32_t sc = *(uint32_t)&sincos_tbl[i];
     samp_s = __SMLABB(sr, sc, samp_s);
@@ -81,6 +94,9 @@ void dsp_process(int16_t *capture, size_t length)
   acc_samp_c = samp_c;
   acc_ref_s = ref_s;
   acc_ref_c = ref_c;
+#ifdef __GAIN_AUTO__
+  acc_samp_peak = peak;
+#endif
 }
 
 void calculate_gamma(float gamma[2])
@@ -116,6 +132,22 @@ void fetch_amplitude_ref(float gamma[2])
   gamma[1] =  acc_ref_c * 1e-9;
 }
 
+#ifdef __GAIN_AUTO__
+// largest sample of the last block, clipping shows as 32767 or more
+int sample_peak(void)
+{
+  return acc_samp_peak;
+}
+
+// sample amplitude at the IF in the last block, same scale as the samples
+float sample_level(void)
+{
+  float ss = acc_samp_s;
+  float sc = acc_samp_c;
+  return sqrtf(ss * ss + sc * sc) * (2 * 16.0f / (SAMPLE_LEN * 32768.0f));
+}
+#endif
+
 void reset_dsp_accumerator(void)
 {
   acc_ref_s = 0;
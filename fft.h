@@ -23,29 +23,94 @@
  */
 
 
-#include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef FFT_SIZE
+#define FFT_SIZE 256
+#endif
+
+// size of the twiddle table below, any power of two FFT up to this size is supported
+#define FFT_TABLE_SIZE 256
+#if FFT_SIZE > FFT_TABLE_SIZE
+#error "FFT_SIZE exceeds FFT_TABLE_SIZE, regenerate fft_sin_table"
+#endif
 
-static uint16_t reverse_bits(uint16_t x, int n) {
-	uint16_t result = 0;
-	for (int i = 0; i < n; i++, x >>= 1)
-		result = (result << 1) | (x & 1U);
-	return result;
+// sin(2*pi*k/FFT_TABLE_SIZE), k = 0..FFT_TABLE_SIZE/4
+static const float fft_sin_table[FFT_TABLE_SIZE/4+1] = {
+  0.000000000f, 0.024541229f, 0.049067674f, 0.073564564f,
+  0.098017140f, 0.122410675f, 0.146730474f, 0.170961889f,
+  0.195090322f, 0.219101240f, 0.242980180f, 0.266712757f,
+  0.290284677f, 0.313681740f, 0.336889853f, 0.359895037f,
+  0.382683432f, 0.405241314f, 0.427555093f, 0.449611330f,
+  0.471396737f, 0.492898192f, 0.514102744f, 0.534997620f,
+  0.555570233f, 0.575808191f, 0.595699304f, 0.615231591f,
+  0.634393284f, 0.653172843f, 0.671558955f, 0.689540545f,
+  0.707106781f, 0.724247083f, 0.740951125f, 0.757208847f,
+  0.773010453f, 0.788346428f, 0.803207531f, 0.817584813f,
+  0.831469612f, 0.844853565f, 0.857728610f, 0.870086991f,
+  0.881921264f, 0.893224301f, 0.903989293f, 0.914209756f,
+  0.923879533f, 0.932992799f, 0.941544065f, 0.949528181f,
+  0.956940336f, 0.963776066f, 0.970031253f, 0.975702130f,
+  0.980785280f, 0.985277642f, 0.989176510f, 0.992479535f,
+  0.995184727f, 0.997290457f, 0.998795456f, 0.999698819f,
+  1.000000000f,
+};
+
+// 8-bit reversal, the index for n points is fft_bitrev_table[i] >> (8 - log2(n))
+static const uint8_t fft_bitrev_table[256] = {
+  0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+  0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8, 0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
+  0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4, 0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
+  0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec, 0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
+  0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2, 0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
+  0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea, 0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
+  0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6, 0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
+  0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee, 0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
+  0x01, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1, 0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
+  0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9, 0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
+  0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5, 0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
+  0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed, 0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
+  0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3, 0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
+  0x0b, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb, 0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
+  0x07, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7, 0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
+  0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef, 0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff,
+};
+
+// cos and sin of 2*pi*k/FFT_TABLE_SIZE, 0 <= k < FFT_TABLE_SIZE
+static inline void fft_twiddle(uint16_t k, float *c, float *s) {
+	const uint16_t q = FFT_TABLE_SIZE/4;
+	if (k <= q) {
+		*s =  fft_sin_table[k];
+		*c =  fft_sin_table[q-k];
+	} else if (k <= 2*q) {
+		*s =  fft_sin_table[2*q-k];
+		*c = -fft_sin_table[k-q];
+	} else if (k <= 3*q) {
+		*s = -fft_sin_table[k-2*q];
+		*c = -fft_sin_table[3*q-k];
+	} else {
+		*s = -fft_sin_table[4*q-k];
+		*c =  fft_sin_table[k-3*q];
+	}
 }
 
+#ifndef __USE_FFT_Q15__
 /***
- * dir = forward: 0, inverse: 1
- * https://www.nayuki.io/res/free-small-fft-in-multiple-languages/fft.c
+ * n points (power of two, n <= FFT_TABLE_SIZE) in place FFT
+ * dir = forward: 0, inverse: 1 (unscaled)
+ * Decimation-in-time radix-4 with a leading radix-2 stage for odd log2(n).
+ * Inverse is done by swapping real and imaginary parts.
  */
-static void fft256(float array[][2], const uint8_t dir) {
-	const uint16_t n = 256;
-	const uint8_t levels = 8; // log2(n)
-
+static void fft(float array[][2], const uint16_t n, const uint8_t dir) {
 	const uint8_t real =   dir & 1;
 	const uint8_t imag = ~real & 1;
+	const uint8_t levels = __builtin_ctz(n); // log2(n)
 
 	for (uint16_t i = 0; i < n; i++) {
-		uint16_t j = reverse_bits(i, levels);
+		uint16_t j = fft_bitrev_table[i] >> (8 - levels);
 		if (j > i) {
 			float temp = array[i][real];
 			array[i][real] = array[j][real];
@@ -56,30 +121,223 @@ static void fft256(float array[][2], const uint8_t dir) {
 		}
 	}
 
-	// Cooley-Tukey decimation-in-time radix-2 FFT
+	uint16_t size = 1;
+	if (levels & 1) {
+		// radix-2 stage, twiddle is 1
+		for (uint16_t i = 0; i < n; i += 2) {
+			float tre = array[i+1][real];
+			float tim = array[i+1][imag];
+			array[i+1][real] = array[i][real] - tre;
+			array[i+1][imag] = array[i][imag] - tim;
+			array[i][real] += tre;
+			array[i][imag] += tim;
+		}
+		size = 2;
+	}
+
+	// radix-4 stages, combine 4 transforms of 'size' points into one of 4*size points
+	// (sub transforms are in order x[4m], x[4m+2], x[4m+1], x[4m+3] after bit reversal)
+	for (; size < n; size *= 4) {
+		const uint16_t step = FFT_TABLE_SIZE / (size * 4);
+		for (uint16_t k = 0; k < size; k++) {
+			float c1, s1, c2, s2, c3, s3;
+			fft_twiddle(k * step,     &c1, &s1);
+			fft_twiddle(k * step * 2, &c2, &s2);
+			fft_twiddle(k * step * 3, &c3, &s3);
+			for (uint16_t i = k; i < n; i += size * 4) {
+				float *a = array[i];
+				float *b = array[i + size];
+				float *c = array[i + size * 2];
+				float *d = array[i + size * 3];
+				// multiply by exp(-j*2*pi*m/(4*size))
+				float bre = b[real] * c2 + b[imag] * s2;
+				float bim = b[imag] * c2 - b[real] * s2;
+				float cre = c[real] * c1 + c[imag] * s1;
+				float cim = c[imag] * c1 - c[real] * s1;
+				float dre = d[real] * c3 + d[imag] * s3;
+				float dim = d[imag] * c3 - d[real] * s3;
+
+				float s0re = a[real] + bre, s0im = a[imag] + bim;
+				float d0re = a[real] - bre, d0im = a[imag] - bim;
+				float s1re = cre + dre,     s1im = cim + dim;
+				float d1re = cre - dre,     d1im = cim - dim;
+
+				a[real] = s0re + s1re;
+				a[imag] = s0im + s1im;
+				b[real] = d0re + d1im;
+				b[imag] = d0im - d1re;
+				c[real] = s0re - s1re;
+				c[imag] = s0im - s1im;
+				d[real] = d0re - d1im;
+				d[imag] = d0im + d1re;
+			}
+		}
+	}
+}
+
+#define FFT_TRANSFORM fft
+#else
+// Q15 sin(2*pi*k/FFT_TABLE_SIZE), k = 0..FFT_TABLE_SIZE/4
+static const int16_t fft_sin_table_q15[FFT_TABLE_SIZE/4+1] = {
+  0, 804, 1608, 2411, 3212, 4011, 4808, 5602,
+  6393, 7180, 7962, 8740, 9512, 10279, 11039, 11793,
+  12540, 13279, 14010, 14733, 15447, 16151, 16846, 17531,
+  18205, 18868, 19520, 20160, 20788, 21403, 22006, 22595,
+  23170, 23732, 24279, 24812, 25330, 25833, 26320, 26791,
+  27246, 27684, 28106, 28511, 28899, 29269, 29622, 29957,
+  30274, 30572, 30853, 31114, 31357, 31581, 31786, 31972,
+  32138, 32286, 32413, 32522, 32610, 32679, 32729, 32758,
+  32767,
+};
+
+static inline void fft_twiddle_q15(uint16_t k, int16_t *c, int16_t *s) {
+	const uint16_t q = FFT_TABLE_SIZE/4;
+	if (k <= q) {
+		*s =  fft_sin_table_q15[k];
+		*c =  fft_sin_table_q15[q-k];
+	} else {
+		*s =  fft_sin_table_q15[2*q-k];
+		*c = -fft_sin_table_q15[k-q];
+	}
+}
+
+/***
+ * n points in place fixed point FFT with block floating point scaling
+ * dir = forward: 0, inverse: 1 (unscaled)
+ * returns exponent of result: X = array * 2^exp
+ * Radix-2, before each stage the block is halved if any |x| could
+ * overflow in a butterfly (|x| * (1 + sqrt(2)) >= 2^15).
+ */
+#define FFT_Q15_PEAK 13572 // 2^15 / (1 + sqrt(2))
+
+static int fft_q15(int16_t array[][2], const uint16_t n, const uint8_t dir) {
+	const uint8_t real =   dir & 1;
+	const uint8_t imag = ~real & 1;
+	const uint8_t levels = __builtin_ctz(n); // log2(n)
+	int exp = 0;
+
+	for (uint16_t i = 0; i < n; i++) {
+		uint16_t j = fft_bitrev_table[i] >> (8 - levels);
+		if (j > i) {
+			int16_t temp = array[i][real];
+			array[i][real] = array[j][real];
+			array[j][real] = temp;
+			temp = array[i][imag];
+			array[i][imag] = array[j][imag];
+			array[j][imag] = temp;
+		}
+	}
+
 	for (uint16_t size = 2; size <= n; size *= 2) {
-		uint16_t halfsize = size / 2;
-		uint16_t tablestep = n / size;
-		for (uint16_t i = 0; i < n; i += size) {
-			for (uint16_t j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
+		int16_t peak = 0;
+		for (uint16_t i = 0; i < n; i++) {
+			int16_t a = abs(array[i][0]), b = abs(array[i][1]);
+			if (a > peak) peak = a;
+			if (b > peak) peak = b;
+		}
+		if (peak >= FFT_Q15_PEAK) {
+			for (uint16_t i = 0; i < n; i++) {
+				array[i][0] >>= 1;
+				array[i][1] >>= 1;
+			}
+			exp++;
+		}
+
+		const uint16_t halfsize = size / 2;
+		const uint16_t step = FFT_TABLE_SIZE / size;
+		for (uint16_t k = 0; k < halfsize; k++) {
+			int16_t c, s;
+			fft_twiddle_q15(k * step, &c, &s);
+			for (uint16_t j = k; j < n; j += size) {
 				uint16_t l = j + halfsize;
-				float tpre =  array[l][real] * cos(2 * M_PI * k / 256) + array[l][imag] * sin(2 * M_PI * k / 256);
-				float tpim = -array[l][real] * sin(2 * M_PI * k / 256) + array[l][imag] * cos(2 * M_PI * k / 256);
-				array[l][real] = array[j][real] - tpre;
-				array[l][imag] = array[j][imag] - tpim;
-				array[j][real] += tpre;
-				array[j][imag] += tpim;
+				int32_t tre = ((int32_t)array[l][real] * c + (int32_t)array[l][imag] * s + (1<<14)) >> 15;
+				int32_t tim = ((int32_t)array[l][imag] * c - (int32_t)array[l][real] * s + (1<<14)) >> 15;
+				array[l][real] = array[j][real] - tre;
+				array[l][imag] = array[j][imag] - tim;
+				array[j][real] += tre;
+				array[j][imag] += tim;
 			}
 		}
-		if (size == n)  // Prevent overflow in 'size *= 2'
-			break;
 	}
+	return exp;
+}
+
+/***
+ * float interface of fft_q15, converts array to Q15 in place
+ * (int16_t pairs are packed to the front of the same buffer)
+ */
+static void fft_q15_float(float array[][2], const uint16_t n, const uint8_t dir) {
+	uint8_t *buf = (uint8_t *)array;
+	int16_t q[2];
+	float peak = 0;
+	uint16_t i;
+	for (i = 0; i < n; i++) {
+		float a = fabsf(array[i][0]), b = fabsf(array[i][1]);
+		if (a > peak) peak = a;
+		if (b > peak) peak = b;
+	}
+	if (peak == 0)
+		return;
+
+	float scale = (FFT_Q15_PEAK - 1) / peak;
+	for (i = 0; i < n; i++) {
+		q[0] = array[i][0] * scale;
+		q[1] = array[i][1] * scale;
+		memcpy(&buf[i * sizeof q], q, sizeof q);
+	}
+
+	int exp = fft_q15((int16_t(*)[2])array, n, dir);
+
+	scale = ldexpf(1.0, exp) / scale;
+	for (i = n; i-- > 0; ) {
+		memcpy(q, &buf[i * sizeof q], sizeof q);
+		array[i][0] = q[0] * scale;
+		array[i][1] = q[1] * scale;
+	}
+}
+
+#define FFT_TRANSFORM fft_q15_float
+#endif
+
+/***
+ * Inverse FFT of a Hermitian symmetric spectrum X[0..n-1] to n real points
+ * using one n/2 point complex FFT (unscaled).
+ * in:  array[k] = X[k] for k = 1..n/2-1, array[0] = { Re(X[0]), Re(X[n/2]) }
+ *      (X[n-k] = conj(X[k]) is implied)
+ * out: ((float *)array)[i] = x[i], i = 0..n-1
+ */
+static void fft_real_inverse(float array[][2], const uint16_t n) {
+	const uint16_t half = n / 2;
+	const uint16_t step = FFT_TABLE_SIZE / n;
+
+	// Z[k] = (X[k] + X[k+n/2]) + j(X[k] - X[k+n/2])exp(j*2*pi*k/n)
+	// packs even samples to real and odd samples to imaginary part
+	float x0 = array[0][0], xh = array[0][1];
+	array[0][0] = x0 + xh;
+	array[0][1] = x0 - xh;
+	for (uint16_t k = 1, j = half - 1; k <= j; k++, j--) {
+		float c, s;
+		fft_twiddle(k * step, &c, &s);
+		float pre = array[k][0] + array[j][0];
+		float pim = array[k][1] - array[j][1];
+		float qre = array[k][0] - array[j][0];
+		float qim = array[k][1] + array[j][1];
+		float wre = qre * c - qim * s;
+		float wim = qre * s + qim * c;
+		array[k][0] = pre - wim;
+		array[k][1] = pim + wre;
+		if (k != j) {
+			array[j][0] = pre + wim;
+			array[j][1] = wre - pim;
+		}
+	}
+	FFT_TRANSFORM(array, half, 1);
 }
 
-static inline void fft256_forward(float array[][2]) {
-	fft256(array, 0);
+static inline void fft_forward(float array[][2]) {
+	FFT_TRANSFORM(array, FFT_SIZE, 0);
 }
 
-static inline void fft256_inverse(float array[][2]) {
-	fft256(array, 1);
+static inline void fft_inverse(float array[][2]) {
+	FFT_TRANSFORM(array, FFT_SIZE, 1);
 }
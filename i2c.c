@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2014-2015, TAKAHASHI Tomohiro (TTRFTECH) edy555@gmail.com
+ * All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * The software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#include "ch.h"
+#include "hal.h"
+#include "nanovna.h"
+#include <string.h>
+
+/*
+ * Bus speeds, fastest first. Each device runs at its own speed: it
+ * starts at the one i2c_tune verified and steps down on errors. Fm+ is
+ * only tried on devices rated for it.
+ */
+typedef struct {
+  uint32_t timingr;
+  uint16_t khz;
+} i2c_speed_t;
+
+static const i2c_speed_t i2c_speeds[] = {
+#ifdef NANOVNA_F303
+  // Fm+, needs the 20mA drive of the I2C1 pins
+  { STM32_TIMINGR_PRESC(5U)  |                      /* 72MHz/6 = 12MHz I2CCLK.          */
+    STM32_TIMINGR_SCLDEL(1U) | STM32_TIMINGR_SDADEL(0U) |
+    STM32_TIMINGR_SCLH(3U)   | STM32_TIMINGR_SCLL(5U), 1000 },
+  { STM32_TIMINGR_PRESC(8U)  |                      /* 72MHz/9 = 8MHz I2CCLK.           */
+    STM32_TIMINGR_SCLDEL(3U) | STM32_TIMINGR_SDADEL(3U) |
+    STM32_TIMINGR_SCLH(3U)   | STM32_TIMINGR_SCLL(9U), 400 },
+  { STM32_TIMINGR_PRESC(15U) |                      /* 72MHz/16 = 4.5MHz I2CCLK.        */
+    STM32_TIMINGR_SCLDEL(4U) | STM32_TIMINGR_SDADEL(2U) |
+    STM32_TIMINGR_SCLH(17U)  | STM32_TIMINGR_SCLL(21U), 100 },
+#else
+  { 0x00300506, 400 }, //voodoo magic 400kHz @ HSI 8MHz
+  { 0x10420F13, 100 },
+#endif
+};
+#define I2C_SPEED_COUNT (int)(sizeof i2c_speeds / sizeof i2c_speeds[0])
+#ifdef NANOVNA_F303
+#define I2C_SPEED_FMP     0
+#define I2C_SPEED_DEFAULT 1
+#else
+#define I2C_SPEED_DEFAULT 0
+#endif
+
+#define I2C_DEVICES     4
+#define I2C_TUNE_MAX    8
+#define I2C_TUNE_ROUNDS 4
+
+typedef struct {
+  uint8_t addr;
+  uint8_t speed;
+} i2c_device_t;
+
+static I2CConfig i2ccfg = {
+  .cr1      = 0,
+  .cr2      = 0
+};
+static i2c_device_t i2c_devices[I2C_DEVICES];
+static int i2c_device_count = 0;
+static int i2c_speed = -1;    // speed the peripheral is set to
+
+volatile uint16_t i2c_errors = 0;
+volatile uint32_t i2c_bytes = 0;    // sent and received, address included
+
+static i2c_device_t *i2c_device(uint8_t addr)
+{
+  for (int i = 0; i < i2c_device_count; i++)
+    if (i2c_devices[i].addr == addr)
+      return &i2c_devices[i];
+  return NULL;
+}
+
+// bus must be acquired
+static msg_t i2c_transfer_at(int speed, uint8_t addr, const uint8_t *tx, int txlen, uint8_t *rx, int rxlen)
+{
+  if (speed != i2c_speed) {
+    I2CD1.i2c->CR1 &= ~I2C_CR1_PE;
+    I2CD1.i2c->TIMINGR = i2c_speeds[speed].timingr;
+#ifdef I2C_SPEED_FMP
+    if (speed == I2C_SPEED_FMP)
+      SYSCFG->CFGR1 |= SYSCFG_CFGR1_I2C1_FMP;
+    else
+      SYSCFG->CFGR1 &= ~SYSCFG_CFGR1_I2C1_FMP;
+#endif
+    I2CD1.i2c->CR1 |= I2C_CR1_PE;
+    i2c_speed = speed;
+  }
+  msg_t mr = i2cMasterTransmitTimeout(&I2CD1, addr, tx, txlen, rx, rxlen, 1000);
+  if (mr == MSG_TIMEOUT) {
+    // driver is locked after a timeout
+    i2cStop(&I2CD1);
+    i2cStart(&I2CD1, &i2ccfg);
+    i2c_speed = -1;
+  }
+  return mr;
+}
+
+static bool i2c_transfer(uint8_t addr, const uint8_t *tx, int txlen, uint8_t *rx, int rxlen)
+{
+  i2c_device_t *dev = i2c_device(addr);
+  msg_t mr;
+  i2cAcquireBus(&I2CD1);
+  while (1) {
+    mr = i2c_transfer_at(dev ? dev->speed : I2C_SPEED_DEFAULT, addr, tx, txlen, rx, rxlen);
+    i2c_bytes += 1 + txlen + (rxlen ? 1 + rxlen : 0);
+    if (mr == MSG_OK)
+      break;
+    i2c_errors++;
+    // retry slower
+    if (dev == NULL || dev->speed == I2C_SPEED_COUNT - 1)
+      break;
+    dev->speed++;
+  }
+  i2cReleaseBus(&I2CD1);
+  return mr == MSG_OK;
+}
+
+static bool i2c_transmit(uint8_t addr, const uint8_t *buf, int len)
+{
+  return i2c_transfer(addr, buf, len, NULL, 0);
+}
+
+#ifdef __I2C_ASYNC__
+/*
+ * Queued writes: callers copy a register burst into the ring and go on,
+ * the i2c thread sends them in order while the transfer runs on DMA and
+ * interrupts. Reads and i2c_flush wait until the ring is empty. A failed
+ * queued write only shows up in i2c_errors.
+ * The HAL has no completion callback for master transfers. The i2c thread
+ * sleeps in i2cMasterTransmitTimeout while the DMA/IRQ driver moves the
+ * bytes, so the caller runs for the whole transfer as it would with a
+ * callback, at the cost of one context switch per burst.
+ */
+#define I2C_QUEUE_SIZE 8
+#define I2C_QUEUE_DATA 16
+
+typedef struct {
+  uint8_t addr;
+  uint8_t len;
+  uint8_t data[I2C_QUEUE_DATA];
+} i2c_transfer_t;
+
+static i2c_transfer_t i2c_queue[I2C_QUEUE_SIZE];
+static uint8_t i2c_head, i2c_tail;
+static volatile uint8_t i2c_busy;      // queued and not yet sent
+static semaphore_t i2c_free;           // free slots
+static semaphore_t i2c_pending;        // slots to send
+static semaphore_t i2c_done;           // reset when the ring runs empty
+static mutex_t i2c_submit;
+
+static THD_WORKING_AREA(waI2CThread, 512);
+static THD_FUNCTION(I2CThread, arg)
+{
+  (void)arg;
+  chRegSetThreadName("i2c");
+  while (1) {
+    chSemWait(&i2c_pending);
+    i2c_transfer_t *t = &i2c_queue[i2c_tail];
+    i2c_transmit(t->addr, t->data, t->len);
+    chSysLock();
+    i2c_tail = (i2c_tail + 1) % I2C_QUEUE_SIZE;
+    chSemSignalI(&i2c_free);
+    if (--i2c_busy == 0)
+      chSemResetI(&i2c_done, 0);    // wakes every i2c_flush waiter
+    chSchRescheduleS();
+    chSysUnlock();
+  }
+}
+
+void i2c_flush(void)
+{
+  chSysLock();
+  while (i2c_busy)
+    chSemWaitS(&i2c_done);
+  chSysUnlock();
+}
+
+bool i2c_write(uint8_t addr, const uint8_t *buf, int len)
+{
+  if (len > I2C_QUEUE_DATA) {
+    i2c_flush();
+    return i2c_transmit(addr, buf, len);
+  }
+  chMtxLock(&i2c_submit);
+  chSemWait(&i2c_free);
+  i2c_transfer_t *t = &i2c_queue[i2c_head];
+  t->addr = addr;
+  t->len = len;
+  memcpy(t->data, buf, len);
+  i2c_head = (i2c_head + 1) % I2C_QUEUE_SIZE;
+  chSysLock();
+  i2c_busy++;
+  chSemSignalI(&i2c_pending);
+  chSchRescheduleS();
+  chSysUnlock();
+  chMtxUnlock(&i2c_submit);
+  return true;
+}
+#else
+void i2c_flush(void)
+{
+}
+
+bool i2c_write(uint8_t addr, const uint8_t *buf, int len)
+{
+  return i2c_transmit(addr, buf, len);
+}
+#endif
+
+bool i2c_read(uint8_t addr, const uint8_t *tx, int txlen, uint8_t *rx, int rxlen)
+{
+  i2c_flush();
+  return i2c_transfer(addr, tx, txlen, rx, rxlen);
+}
+
+/*
+ * Register addr and find its fastest speed up to max_khz, the datasheet
+ * rating: data[] written at reg (and zeros, alternating) must read back
+ * intact I2C_TUNE_ROUNDS times.
+ * The registers are left with zeros or data, callers set them up after.
+ */
+void i2c_tune(uint8_t addr, uint8_t reg, const uint8_t *data, int len, uint16_t max_khz)
+{
+  int speed;
+  uint8_t buf[I2C_TUNE_MAX + 1];
+  uint8_t rd[I2C_TUNE_MAX];
+  i2c_device_t *dev = i2c_device(addr);
+  if (dev == NULL) {
+    if (i2c_device_count == I2C_DEVICES)
+      return;
+    dev = &i2c_devices[i2c_device_count++];
+    dev->addr = addr;
+  }
+  if (len > I2C_TUNE_MAX)
+    len = I2C_TUNE_MAX;
+  for (speed = 0; speed < I2C_SPEED_COUNT - 1; speed++)
+    if (i2c_speeds[speed].khz <= max_khz)
+      break;
+  i2c_flush();
+  i2cAcquireBus(&I2CD1);
+  for (dev->speed = speed; dev->speed < I2C_SPEED_COUNT - 1; dev->speed++) {
+    int n;
+    for (n = 0; n < I2C_TUNE_ROUNDS; n++) {
+      buf[0] = reg;
+      if (n & 1)
+        memset(&buf[1], 0, len);
+      else
+        memcpy(&buf[1], data, len);
+      if (i2c_transfer_at(dev->speed, addr, buf, len + 1, NULL, 0) != MSG_OK
+          || i2c_transfer_at(dev->speed, addr, &reg, 1, rd, len) != MSG_OK
+          || memcmp(rd, &buf[1], len) != 0)
+        break;
+    }
+    if (n == I2C_TUNE_ROUNDS)
+      break;
+  }
+  i2cReleaseBus(&I2CD1);
+}
+
+// address and bus speed (kHz) of the i-th tuned device, 0 past the last
+int i2c_get_speed(int i, uint8_t *addr)
+{
+  if (i >= i2c_device_count)
+    return 0;
+  *addr = i2c_devices[i].addr;
+  return i2c_speeds[i2c_devices[i].speed].khz;
+}
+
+void i2c_start(void)
+{
+  i2ccfg.timingr = i2c_speeds[I2C_SPEED_DEFAULT].timingr;
+  i2cStart(&I2CD1, &i2ccfg);
+  i2c_speed = I2C_SPEED_DEFAULT;
+#ifdef __I2C_ASYNC__
+  chSemObjectInit(&i2c_free, I2C_QUEUE_SIZE);
+  chSemObjectInit(&i2c_pending, 0);
+  chSemObjectInit(&i2c_done, 0);
+  chMtxObjectInit(&i2c_submit);
+  chThdCreateStatic(waI2CThread, sizeof(waI2CThread), NORMALPRIO + 1, I2CThread, NULL);
+#endif
+}
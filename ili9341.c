@@ -31,11 +31,11 @@
 
 uint16_t spi_buffer[SPI_BUFFER_SIZE];
 
-//static void ssp_wait(void)
-//{
-//  while (SPI1->SR & SPI_SR_BSY)
-//    ;
-//}
+static void ssp_wait(void)
+{
+  while (SPI1->SR & (SPI_SR_FTLVL | SPI_SR_BSY))
+    ;
+}
 
 static void ssp_wait_slot(void)
 {
@@ -70,14 +70,13 @@ static void ssp_senddata16(uint16_t x)
 }
 
  #ifdef ILI9488
-static inline void ssp_senddata16RGB(uint16_t x)
+// expand RGB565 pixel to 3 bytes of RGB666 (18bit interface format)
+static inline uint8_t *rgb565_to_666(uint8_t *p, uint16_t x)
 {
-  uint8_t r = (x & 0xF800) >> 8;
-  uint8_t g = (x & 0x07E0) >> 3;
-  uint8_t b = (x & 0x001F) << 3;
-  ssp_senddata(r);
-  ssp_senddata(g);
-  ssp_senddata(b);
+  *p++ = (x & 0xF800) >> 8;
+  *p++ = (x & 0x07E0) >> 3;
+  *p++ = (x & 0x001F) << 3;
+  return p;
 }
 #endif
 
@@ -96,10 +95,44 @@ static void ssp_databit8(void)
 
 static const stm32_dma_stream_t  *dmatx;
 static uint32_t txdmamode;
+static uint32_t txdmamode8;
+static const stm32_dma_stream_t  *dmarx;
+static uint32_t rxdmamode;
+#ifdef ILI9488
+// RGB666 staging, one half is expanded while the other is sent
+#define RGB_STAGE_PIXELS 64
+static uint8_t rgb_stage[2][RGB_STAGE_PIXELS*3];
+#endif
+#ifdef __LCD_ASYNC__
+static binary_semaphore_t bulk_done;
+static bool bulk_pending = false;
+#endif
+// transfers longer than one DMA run are continued in dma_chunk pieces
+static uint32_t dma_remain;
+static uint16_t dma_chunk;
+
+static void spi_dma_next(void)
+{
+  uint32_t n = dma_remain > dma_chunk ? dma_chunk : dma_remain;
+  dma_remain -= n;
+  dmaStreamSetTransactionSize(dmatx, n);
+  dmaStreamEnable(dmatx);
+}
 
 static void spi_lld_serve_tx_interrupt(SPIDriver *spip, uint32_t flags) {
   (void)spip;
   (void)flags;
+#ifdef __LCD_ASYNC__
+  if (bulk_pending && dma_remain) {
+    dmaStreamDisable(dmatx);
+    spi_dma_next();
+    return;
+  }
+  // transfer complete (or error), wake up ili9341_bulk_wait
+  chSysLockFromISR();
+  chBSemSignalI(&bulk_done);
+  chSysUnlockFromISR();
+#endif
 }
 
 static void spi_init(void)
@@ -114,12 +147,37 @@ static void spi_init(void)
     STM32_DMA_CR_TEIE |
     STM32_DMA_CR_PSIZE_HWORD |
     STM32_DMA_CR_MSIZE_HWORD;
+  txdmamode8 = STM32_DMA_CR_CHSEL(SPI1_TX_DMA_CHANNEL) |
+    STM32_DMA_CR_PL(STM32_SPI_SPI1_DMA_PRIORITY) |
+    STM32_DMA_CR_DIR_M2P |
+    STM32_DMA_CR_DMEIE |
+    STM32_DMA_CR_TEIE |
+    STM32_DMA_CR_PSIZE_BYTE |
+    STM32_DMA_CR_MSIZE_BYTE;
   dmaStreamAlloc(dmatx,
                     STM32_SPI_SPI1_IRQ_PRIORITY,
                     (stm32_dmaisr_t)spi_lld_serve_tx_interrupt,
                     NULL);
   dmaStreamSetPeripheral(dmatx, &SPI1->DR);
 
+  // used for LCD memory read only
+  dmarx     = STM32_DMA_STREAM(STM32_SPI_SPI1_RX_DMA_STREAM);
+  rxdmamode = STM32_DMA_CR_CHSEL(SPI1_RX_DMA_CHANNEL) |
+    STM32_DMA_CR_PL(STM32_SPI_SPI1_DMA_PRIORITY) |
+    STM32_DMA_CR_DIR_P2M |
+    STM32_DMA_CR_DMEIE |
+    STM32_DMA_CR_TEIE |
+    STM32_DMA_CR_PSIZE_BYTE |
+    STM32_DMA_CR_MSIZE_BYTE;
+  dmaStreamAlloc(dmarx,
+                    STM32_SPI_SPI1_IRQ_PRIORITY,
+                    NULL,
+                    NULL);
+  dmaStreamSetPeripheral(dmarx, &SPI1->DR);
+#ifdef __LCD_ASYNC__
+  chBSemObjectInit(&bulk_done, true);
+#endif
+
   SPI1->CR1 = 0;
   SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI;// | SPI_CR1_BR_1;
   SPI1->CR2 = 0x0700 | SPI_CR2_TXDMAEN | SPI_CR2_FRXTH;
@@ -128,6 +186,10 @@ static void spi_init(void)
 
 static void send_command(uint8_t cmd, int len, const uint8_t *data)
 {
+#ifdef __LCD_ASYNC__
+  // finish pending bulk transfer before DC change
+  ili9341_bulk_wait();
+#endif
   CS_LOW;
   DC_CMD;
   ssp_databit8();
@@ -329,46 +391,96 @@ void ili9341_pixel(int x, int y, int color)
 
 
 
-#if defined(ILI9488) 
-void ili9341_fill(int x, int y, int w, int h, int color)
+#ifdef ILI9488
+// fill color as RGB888 byte stream, 2 pixels in 3 halfwords
+#define FILL_PATTERN_SIZE (3*32)
+static uint16_t fill_pattern[FILL_PATTERN_SIZE];
+static int fill_pattern_color = -1;
+#else
+static uint16_t fill_color;
+#endif
+
+/*
+ * Start DMA fill of the area from a single color source (no memory
+ * increment) or, for ILI9488, from a small pre-expanded pattern.
+ */
+static void ili9341_fill_start(int x, int y, int w, int h, int color, uint32_t mode)
 {
-  chMtxLock(&mutex_ili9341);
-  if (((x+w)>LCD_WIDTH) || ((y+h)>LCD_HEIGHT)) {
-    return;
-  }
   uint8_t xx[4] = { x >> 8, x, (x+w-1) >> 8, (x+w-1) };
   uint8_t yy[4] = { y >> 8, y, (y+h-1) >> 8, (y+h-1) };
-  int len = w * h;
-  uint8_t r = (color & 0xF800) >> 8;
-  uint8_t g = (color & 0x07E0) >> 3;
-  uint8_t b = (color & 0x001F) << 3;
-  uint16_t rg = r<<8 | g;
-  uint16_t br = b<<8 | r;
-  uint16_t gb = g<<8 | b;  
   send_command(0x2A, 4, xx);
   send_command(0x2B, 4, yy);
   send_command(0x2C, 0, NULL);
-  while (len > 0) {
-    ssp_senddata16(rg);
-    ssp_senddata16(br);
-    ssp_senddata16(gb);
-    len -= 2;
+#ifdef ILI9488
+  if (fill_pattern_color != color) {
+    uint8_t r = (color & 0xF800) >> 8;
+    uint8_t g = (color & 0x07E0) >> 3;
+    uint8_t b = (color & 0x001F) << 3;
+    int i;
+    for (i = 0; i < FILL_PATTERN_SIZE; i += 3) {
+      fill_pattern[i+0] = r<<8 | g;
+      fill_pattern[i+1] = b<<8 | r;
+      fill_pattern[i+2] = g<<8 | b;
+    }
+    fill_pattern_color = color;
   }
-  chMtxUnlock(&mutex_ili9341);
-}
+  dma_remain = (w * h + 1) / 2 * 3;
+  dma_chunk = FILL_PATTERN_SIZE;
+  dmaStreamSetMemory0(dmatx, fill_pattern);
+  dmaStreamSetMode(dmatx, txdmamode | STM32_DMA_CR_MINC | mode);
 #else
+  fill_color = color;
+  dma_remain = w * h;
+  dma_chunk = 0xffff;
+  dmaStreamSetMemory0(dmatx, &fill_color);
+  dmaStreamSetMode(dmatx, txdmamode | mode);
+#endif
+#ifdef __LCD_ASYNC__
+  if (mode & STM32_DMA_CR_TCIE) {
+    // continued and completed in DMA interrupt
+    chBSemReset(&bulk_done, true);
+    bulk_pending = true;
+  }
+#endif
+  spi_dma_next();
+}
+
 void ili9341_fill(int x, int y, int w, int h, int color)
 {
-	chMtxLock(&mutex_ili9341);
-	uint8_t xx[4] = { x >> 8, x, (x+w-1) >> 8, (x+w-1) };
-	uint8_t yy[4] = { y >> 8, y, (y+h-1) >> 8, (y+h-1) };
-    int len = w * h;
-	send_command(0x2A, 4, xx);
-    send_command(0x2B, 4, yy);
-    send_command(0x2C, 0, NULL);
-    while (len-- > 0)
-      ssp_senddata16(color);
-	chMtxUnlock(&mutex_ili9341);
+  if (w <= 0 || h <= 0)
+    return;
+#ifdef ILI9488
+  if (x+w > LCD_WIDTH || y+h > LCD_HEIGHT)
+    return;
+#endif
+  chMtxLock(&mutex_ili9341);
+  ili9341_fill_start(x, y, w, h, color, 0);
+  while (1) {
+    dmaWaitCompletion(dmatx);
+    if (dma_remain == 0)
+      break;
+    spi_dma_next();
+  }
+  ssp_wait();
+  chMtxUnlock(&mutex_ili9341);
+}
+
+#ifdef __LCD_ASYNC__
+/*
+ * Same as ili9341_fill but returns after DMA start, next LCD command
+ * waits for completion. spi_buffer is not used, so it is free meanwhile.
+ */
+void ili9341_fill_async(int x, int y, int w, int h, int color)
+{
+  if (w <= 0 || h <= 0)
+    return;
+#ifdef ILI9488
+  if (x+w > LCD_WIDTH || y+h > LCD_HEIGHT)
+    return;
+#endif
+  chMtxLock(&mutex_ili9341);
+  ili9341_fill_start(x, y, w, h, color, STM32_DMA_CR_TCIE);
+  chMtxUnlock(&mutex_ili9341);
 }
 #endif
 
@@ -399,11 +511,24 @@ void ili9341_bulk(int x, int y, int w, int h)
 	send_command(0x2B, 4, yy);
 	send_command(0x2C, 0, NULL);
     #ifdef ILI9488
-    uint16_t *buf=spi_buffer;
-    ssp_databit8();
-    while (len-- > 0) 
-      ssp_senddata16RGB(*buf++);
-    ssp_databit16();
+    uint16_t *buf = spi_buffer;
+    int i = 0;
+    // expand next chunk while DMA sends previous one
+    while (len > 0) {
+      int n = len > RGB_STAGE_PIXELS ? RGB_STAGE_PIXELS : len;
+      uint8_t *p = rgb_stage[i];
+      len -= n;
+      while (n-- > 0)
+        p = rgb565_to_666(p, *buf++);
+      dmaWaitCompletion(dmatx);
+      dmaStreamSetMemory0(dmatx, rgb_stage[i]);
+      dmaStreamSetTransactionSize(dmatx, p - rgb_stage[i]);
+      dmaStreamSetMode(dmatx, txdmamode8 | STM32_DMA_CR_MINC);
+      dmaStreamEnable(dmatx);
+      i ^= 1;
+    }
+    dmaWaitCompletion(dmatx);
+    ssp_wait();
     #else
     dmaStreamSetMemory0(dmatx, spi_buffer);
     dmaStreamSetTransactionSize(dmatx, len);
@@ -415,37 +540,96 @@ void ili9341_bulk(int x, int y, int w, int h)
 }
 #endif
 
+#ifdef __LCD_ASYNC__
+/*
+ * Start DMA transfer of buf and return without waiting. The caller must
+ * keep mutex_ili9341 and buf untouched until ili9341_bulk_wait(), any
+ * following LCD command waits for it implicitly.
+ */
+void ili9341_bulk_async(int x, int y, int w, int h, const uint16_t *buf)
+{
+  chMtxLock(&mutex_ili9341);
+  uint8_t xx[4] = { x >> 8, x, (x+w-1) >> 8, (x+w-1) };
+  uint8_t yy[4] = { y >> 8, y, (y+h-1) >> 8, (y+h-1) };
+
+  send_command(0x2A, 4, xx);
+  send_command(0x2B, 4, yy);
+  send_command(0x2C, 0, NULL);
+  chBSemReset(&bulk_done, true);
+  dma_remain = 0;
+  dmaStreamSetMemory0(dmatx, buf);
+  dmaStreamSetTransactionSize(dmatx, w * h);
+  dmaStreamSetMode(dmatx, txdmamode | STM32_DMA_CR_MINC | STM32_DMA_CR_TCIE);
+  bulk_pending = true;
+  dmaStreamEnable(dmatx);
+  chMtxUnlock(&mutex_ili9341);
+}
+
+void ili9341_bulk_wait(void)
+{
+  if (!bulk_pending)
+    return;
+  chBSemWait(&bulk_done);
+  dmaStreamDisable(dmatx);
+  // wait last data shifted out
+  ssp_wait();
+  bulk_pending = false;
+}
+#endif
+
+#ifdef ST7796S  // read data is 16bit
+#define LCD_READ_PIXEL_BYTES 2
+#else // read data is always 18bit
+#define LCD_READ_PIXEL_BYTES 3
+#endif
+
+/*
+ * Read len pixels by DMA (TX DMA clocks out dummy bytes).
+ * Raw data is received into out and converted to RGB565 in place,
+ * so out must have room for len*LCD_READ_PIXEL_BYTES bytes.
+ */
 static void ili9341_read_memory_raw(uint8_t cmd, int len, uint16_t* out)
 {
-    uint8_t r, g, b;
+    static const uint8_t dummy = 0;
+    uint8_t *raw = (uint8_t *)out;
+    int n = len * LCD_READ_PIXEL_BYTES;
     send_command(cmd, 0, NULL);
     ssp_databit8();
 
     // consume old data
     while (!(SPI1->SR & SPI_SR_TXE));
     // clear OVR
-    while (SPI1->SR & SPI_SR_RXNE) r = SPI1->DR;
+    while (SPI1->SR & SPI_SR_RXNE) (void)SPI1->DR;
 
     // require 8bit dummy clock
-    r = ssp_sendrecvdata(0);
-
-    while (--len > 0) {
-
+    (void)ssp_sendrecvdata(0);
+
+    dmaStreamSetMemory0(dmarx, raw);
+    dmaStreamSetTransactionSize(dmarx, n);
+    dmaStreamSetMode(dmarx, rxdmamode | STM32_DMA_CR_MINC);
+    dmaStreamSetMemory0(dmatx, &dummy);
+    dmaStreamSetTransactionSize(dmatx, n);
+    dmaStreamSetMode(dmatx, txdmamode8);
+    SPI1->CR2 |= SPI_CR2_RXDMAEN;
+    dmaStreamEnable(dmarx);
+    dmaStreamEnable(dmatx);
+    dmaWaitCompletion(dmarx);
+    dmaWaitCompletion(dmatx);
+    SPI1->CR2 &= ~SPI_CR2_RXDMAEN;
 
+    CS_HIGH;
 
-	#ifdef ST7796S  // read data is 16bit
-        r = ssp_sendrecvdata(0);
-        g = ssp_sendrecvdata(0);
-        *out++ = (r << 8) | g ;
-	#else // read data is always 18bit
-        r = ssp_sendrecvdata(0);
-        g = ssp_sendrecvdata(0);
-        b = ssp_sendrecvdata(0);
+    // convert forward, write position never passes read position
+    while (len-- > 0) {
+        uint8_t r = *raw++;
+        uint8_t g = *raw++;
+	#ifdef ST7796S
+        *out++ = (r << 8) | g;
+	#else
+        uint8_t b = *raw++;
         *out++ = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
 	#endif
     }
-
-    CS_HIGH;
 }
 
 void ili9341_read_memory(int x, int y, int w, int h, int len, uint16_t *out)
@@ -593,6 +777,11 @@ ili9341_drawstring_size(const char *str, int x, int y, uint16_t fg, uint16_t bg,
 
 #define SWAP(x,y) { int z=x; x = y; y = z; }
 
+/*
+ * Bresenham line, each horizontal (x major) or vertical (y major) run of
+ * pixels is sent as one blocking ili9341_fill, one DMA start per run (per
+ * pixel on a diagonal).
+ */
 void ili9341_line(int x0, int y0, int x1, int y1, uint16_t fg)
 {
     chMtxLock(&mutex_ili9341);
@@ -601,30 +790,45 @@ void ili9341_line(int x0, int y0, int x1, int y1, uint16_t fg)
         SWAP(y0, y1);
     }
 
-    while (x0 <= x1) {
-        int dx = x1 - x0 + 1;
-        int dy = y1 - y0;
-        if (dy >= 0) {
-            dy++;
-            if (dy > dx) {
-                dy /= dx; dx = 1;
-            } else {
-                dx /= dy; dy = 1;
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+    int sy = dy > 0 ? 1 : -1;
+    int e;
+    dy *= sy;
+
+    if (dx >= dy) {
+        e = dy * 2 - dx;
+        while (1) {
+            int xs = x0;
+            while (x0 != x1 && e <= 0) {
+                e += dy * 2;
+                x0++;
             }
-        } else {
-            dy--;
-            if (-dy > dx) {
-                    dy /= dx; dx = 1;
-            } else {
-                dx /= -dy; dy = -1;
+            ili9341_fill(xs, y0, x0 - xs + 1, 1, fg);
+            if (x0 == x1)
+                break;
+            e += (dy - dx) * 2;
+            x0++;
+            y0 += sy;
+        }
+    } else {
+        e = dx * 2 - dy;
+        while (1) {
+            int ys = y0;
+            while (y0 != y1 && e <= 0) {
+                e += dx * 2;
+                y0 += sy;
             }
+            if (sy > 0)
+                ili9341_fill(x0, ys, 1, y0 - ys + 1, fg);
+            else
+                ili9341_fill(x0, y0, 1, ys - y0 + 1, fg);
+            if (y0 == y1)
+                break;
+            e += (dx - dy) * 2;
+            y0 += sy;
+            x0++;
         }
-        if (dy > 0)
-            ili9341_fill(x0, y0, dx, dy, fg);
-        else
-            ili9341_fill(x0, y0+dy, dx, -dy, fg);
-        x0 += dx;
-        y0 += dy;
     }
     chMtxUnlock(&mutex_ili9341);
 }
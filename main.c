@@ -42,12 +42,12 @@
 #include <math.h>
 
 #define START_MIN 10000
-#define STOP_MAX 1500000000
+#define STOP_MAX 2100000000
 
 static void apply_error_term_at(int i);
 static void apply_edelay_at(int i);
 static void cal_interpolate(int s);
-static void update_frequencies(void);
+static void cal_interpolate_auto(void);
 static void set_frequencies(uint32_t start, uint32_t stop, int16_t points);
 static bool sweep(bool break_on_operation);
 
@@ -64,9 +64,12 @@ static int8_t drive_strength = SI5351_CLK_DRIVE_STRENGTH_8MA;
 int8_t sweep_enabled = TRUE;
 static int8_t sweep_once = FALSE;
 static int8_t cal_auto_interpolate = TRUE;
+uint8_t cal_segments = 0; // bitmask of save slots used as segments of one cal set
+static int8_t cal_segment_index[POINT_COUNT]; // save slot applied at each sweep point
 uint16_t redraw_request = 0; // contains REDRAW_XXX flags
 int16_t vbat = 0;
 bool pll_lock_failed;
+static uint16_t sweep_i2c_bytes = 0; // i2c bytes per point of the last full sweep
 
 
 static THD_WORKING_AREA(waThread1, 2048);
@@ -149,85 +152,387 @@ static float bessel0(float x) {
 	return ret;
 }
 
-static float kaiser_window(float k, float n, float beta) {
-	if (beta == 0.0) return 1.0;
-	float r = (2 * k) / (n - 1) - 1;
-	return bessel0(beta * sqrt(1 - r * r)) / bessel0(beta);
+static float td_window[POINT_COUNT];       // window coefficients for transform_domain
+static uint8_t td_window_mode = 0xff;      // TD_FUNC|TD_WINDOW td_window is built for
+static int16_t td_window_points;           // sweep_points td_window is built for
+static uint8_t td_window_beta;             // kaiser_beta td_window is built for
+
+// r: position in window -1..1
+static float window_coeff(float r, uint8_t window, float beta, float bessel0_beta) {
+	switch (window) {
+	case TD_WINDOW_HANN:
+		return 0.5 + 0.5 * cosf(M_PI * r);
+	case TD_WINDOW_BLACKMAN_HARRIS:
+		return 0.35875 + 0.48829 * cosf(M_PI * r)
+		     + 0.14128 * cosf(2 * M_PI * r) + 0.01168 * cosf(3 * M_PI * r);
+	default:
+		if (beta == 0.0) return 1.0;
+		return bessel0(beta * sqrtf(1 - r * r)) / bessel0_beta;
+	}
+}
+
+// rebuild td_window only when window, function, point count or beta is changed
+static void update_td_window(void)
+{
+	uint8_t mode = domain_mode & (TD_FUNC|TD_WINDOW);
+	if (mode == td_window_mode && sweep_points == td_window_points
+	    && ((mode & TD_WINDOW) != TD_WINDOW_KAISER || kaiser_beta == td_window_beta))
+		return;
+
+	int window_size = sweep_points, offset = 0;
+	if ((mode & TD_FUNC) != TD_FUNC_BANDPASS) {
+		// lowpass uses right half of the window
+		offset = sweep_points;
+		window_size = sweep_points * 2;
+	}
+
+	float beta = 0.0;
+	switch (mode & TD_WINDOW) {
+	case TD_WINDOW_MINIMUM:
+		beta = 0.0; // this is rectangular
+		break;
+	case TD_WINDOW_NORMAL:
+		beta = 6.0;
+		break;
+	case TD_WINDOW_MAXIMUM:
+		beta = 13;
+		break;
+	case TD_WINDOW_KAISER:
+		beta = kaiser_beta / 10.0;
+		break;
+	}
+	float bessel0_beta = bessel0(beta);
+
+	for (int i = 0; i < sweep_points; i++) {
+		float r = (2.0 * (i + offset)) / (window_size - 1) - 1;
+		td_window[i] = window_coeff(r, mode & TD_WINDOW, beta, bessel0_beta);
+	}
+	td_window_mode = mode;
+	td_window_points = sweep_points;
+	td_window_beta = kaiser_beta;
+}
+
+#ifdef __TD_ZOOM__
+/*
+ * Zoomed time domain by chirp-z transform (Bluestein):
+ *   y(t_k) = sum X_n exp(j*2*pi*n*df*t_k), t_k = t0 + k*dt
+ *          = post_k * sum (X_n pre_n) kernel_(k-n)
+ * The convolution is done by FFT_SIZE point FFTs (needs FFT_SIZE >= 2*POINT_COUNT-1).
+ */
+float td_zoom_start = 0.0;
+float td_zoom_stop = 0.0;
+
+static float czt_pre[POINT_COUNT][2];     // exp(j*(theta0*n + phi*n^2/2))
+static float czt_post[POINT_COUNT][2];    // exp(j*phi*k^2/2) / FFT_SIZE
+static float czt_kernel[FFT_SIZE][2];     // FFT of exp(-j*phi*n^2/2) / FFT_SIZE
+static uint32_t czt_df;                   // parameters czt tables are built for
+static float czt_start, czt_stop;
+static int16_t czt_points;
+
+#if 2*POINT_COUNT-1 > FFT_SIZE
+#error "FFT_SIZE too small for chirp-z"
+#endif
+
+static void czt_expj(float v[2], double angle)
+{
+  angle = fmod(angle, 2 * M_PI);
+  v[0] = cos(angle);
+  v[1] = sin(angle);
+}
+
+static void update_czt_tables(void)
+{
+  uint32_t df = frequencies[1] - frequencies[0];
+  int points = sweep_points;
+  if (df == czt_df && czt_start == td_zoom_start && czt_stop == td_zoom_stop && czt_points == points)
+    return;
+
+  double theta0 = 2 * M_PI * (double)df * td_zoom_start;
+  double phi = 2 * M_PI * (double)df * (td_zoom_stop - td_zoom_start) / (points - 1);
+  int n;
+  for (n = 0; n < points; n++) {
+    double nn = (double)n * n / 2;
+    czt_expj(czt_pre[n], theta0 * n + phi * nn);
+    czt_expj(czt_post[n], phi * nn);
+    czt_post[n][0] /= (float)FFT_SIZE;
+    czt_post[n][1] /= (float)FFT_SIZE;
+  }
+  // kernel at -(points-1)..points-1, negative index wrap around
+  memset(czt_kernel, 0, sizeof czt_kernel);
+  for (n = 0; n < points; n++) {
+    czt_expj(czt_kernel[n], -phi * n * n / 2);
+    if (n > 0) {
+      czt_kernel[FFT_SIZE-n][0] = czt_kernel[n][0];
+      czt_kernel[FFT_SIZE-n][1] = czt_kernel[n][1];
+    }
+  }
+  fft_forward(czt_kernel);
+  for (n = 0; n < FFT_SIZE; n++) {
+    czt_kernel[n][0] /= (float)FFT_SIZE;
+    czt_kernel[n][1] /= (float)FFT_SIZE;
+  }
+
+  czt_df = df;
+  czt_start = td_zoom_start;
+  czt_stop = td_zoom_stop;
+  czt_points = points;
+}
+
+static void transform_domain_zoom(void)
+{
+  uint8_t is_lowpass = (domain_mode & TD_FUNC) != TD_FUNC_BANDPASS;
+  update_czt_tables();
+
+  chMtxLock(&mutex_ili9341); // [protect spi_buffer]
+  // use spi_buffer as temporary buffer
+  float (*tmp)[2] = (float(*)[2])spi_buffer;
+
+  for (int ch = 0; ch < 2; ch++) {
+    int i;
+    for (i = 0; i < sweep_points; i++) {
+      float w = td_window[i];
+      float re = measured[ch][i][0] * w;
+      float im = measured[ch][i][1] * w;
+      if (is_lowpass && i == 0) {
+        // real output is 2*Re(sum), count DC once
+        re /= 2;
+        im = 0.0;
+      }
+      tmp[i][0] = re * czt_pre[i][0] - im * czt_pre[i][1];
+      tmp[i][1] = re * czt_pre[i][1] + im * czt_pre[i][0];
+    }
+    for (; i < FFT_SIZE; i++) {
+      tmp[i][0] = 0.0;
+      tmp[i][1] = 0.0;
+    }
+
+    fft_forward(tmp);
+    for (i = 0; i < FFT_SIZE; i++) {
+      float re = tmp[i][0] * czt_kernel[i][0] - tmp[i][1] * czt_kernel[i][1];
+      float im = tmp[i][0] * czt_kernel[i][1] + tmp[i][1] * czt_kernel[i][0];
+      tmp[i][0] = re;
+      tmp[i][1] = im;
+    }
+    fft_inverse(tmp);
+
+    for (i = 0; i < sweep_points; i++) {
+      float re = tmp[i][0] * czt_post[i][0] - tmp[i][1] * czt_post[i][1];
+      float im = tmp[i][0] * czt_post[i][1] + tmp[i][1] * czt_post[i][0];
+      if (is_lowpass) {
+        measured[ch][i][0] = 2 * re;
+        measured[ch][i][1] = 0.0;
+      } else {
+        measured[ch][i][0] = re;
+        measured[ch][i][1] = im;
+      }
+    }
+  }
+  chMtxUnlock(&mutex_ili9341); // [/protect spi_buffer]
+}
+#endif
+
+#ifdef __TD_GATE__
+/*
+ * Time domain gating: measured[] is windowed, transformed to time domain,
+ * multiplied by the gate and transformed back to frequency domain. The
+ * result is divided by the same gating of the bare window (centered on
+ * the gate), which takes the window out again and levels the band edges.
+ * The window is the normal Kaiser, wider ones need wider gates.
+ */
+#define GATE_SHAPE_RECT   0
+#define GATE_SHAPE_NORMAL 1
+#define GATE_SHAPE_WIDE   2
+static float td_gate_start = 0.0;       // seconds, gate is off when stop <= start
+static float td_gate_stop = 0.0;
+static uint8_t td_gate_shape = GATE_SHAPE_NORMAL;
+
+#define GATE_WINDOW_BETA  6.0
+
+static float td_gate[FFT_SIZE];         // gate / FFT_SIZE for each time bin
+static float td_gate_window[POINT_COUNT];
+static float td_gate_norm[POINT_COUNT][2];  // 1 / gated window
+static float gate_buffer[FFT_SIZE][2];
+static uint32_t gate_df;                // parameters the tables are built for
+static int16_t gate_points;
+static float gate_start, gate_stop;
+static uint8_t gate_shape = 0xff;
+
+static void update_gate_table(void)
+{
+  uint32_t df = frequencies[1] - frequencies[0];
+  int i;
+  if (df == gate_df && sweep_points == gate_points &&
+      gate_start == td_gate_start && gate_stop == td_gate_stop && gate_shape == td_gate_shape)
+    return;
+
+  // hann shaped edges inside of gate span
+  static const float taper_ratio[] = { 0.0, 0.125, 0.25 };
+  float taper = (td_gate_stop - td_gate_start) * taper_ratio[td_gate_shape];
+  float bin = 1.0 / ((float)df * FFT_SIZE);
+  for (i = 0; i < FFT_SIZE; i++) {
+    // upper half of bins are negative time
+    float t = (i < FFT_SIZE/2 ? i : i - FFT_SIZE) * bin;
+    float g;
+    if (t < td_gate_start || t > td_gate_stop)
+      g = 0.0;
+    else if (t < td_gate_start + taper)
+      g = 0.5 - 0.5 * cosf(M_PI * (t - td_gate_start) / taper);
+    else if (t > td_gate_stop - taper)
+      g = 0.5 - 0.5 * cosf(M_PI * (td_gate_stop - t) / taper);
+    else
+      g = 1.0;
+    td_gate[i] = g / FFT_SIZE;
+  }
+
+  float bessel0_beta = bessel0(GATE_WINDOW_BETA);
+  for (i = 0; i < sweep_points; i++) {
+    float r = sweep_points > 1 ? (2.0 * i) / (sweep_points - 1) - 1 : 0.0;
+    td_gate_window[i] = window_coeff(r, TD_WINDOW_NORMAL, GATE_WINDOW_BETA, bessel0_beta);
+  }
+
+  // gate the window's own time response, gate moved to time 0
+  int center = (int)floorf((td_gate_start + td_gate_stop) / (2 * bin) + 0.5) & (FFT_SIZE-1);
+  float (*tmp)[2] = gate_buffer;
+  for (i = 0; i < FFT_SIZE; i++) {
+    tmp[i][0] = i < sweep_points ? td_gate_window[i] : 0.0;
+    tmp[i][1] = 0.0;
+  }
+  fft_inverse(tmp);
+  for (i = 0; i < FFT_SIZE; i++) {
+    float g = td_gate[(i + center) & (FFT_SIZE-1)];
+    tmp[i][0] *= g;
+    tmp[i][1] *= g;
+  }
+  fft_forward(tmp);
+  for (i = 0; i < sweep_points; i++) {
+    float mag2 = tmp[i][0] * tmp[i][0] + tmp[i][1] * tmp[i][1];
+    if (mag2 < 1e-12) mag2 = INFINITY;  // out of the gate, leave it dark
+    td_gate_norm[i][0] = tmp[i][0] / mag2;
+    td_gate_norm[i][1] = -tmp[i][1] / mag2;
+  }
+
+  gate_df = df;
+  gate_points = sweep_points;
+  gate_start = td_gate_start;
+  gate_stop = td_gate_stop;
+  gate_shape = td_gate_shape;
 }
 
+static void gate_domain(void)
+{
+  if (td_gate_stop <= td_gate_start) return; // gate is off
+  // only error corrected data, never the raw standards cal_collect takes
+  if (!(cal_status & CALSTAT_APPLY)) return;
+
+  update_gate_table();
+
+  float (*tmp)[2] = gate_buffer;
+
+  for (int ch = 0; ch < 2; ch++) {
+    int i;
+    for (i = 0; i < sweep_points; i++) {
+      tmp[i][0] = measured[ch][i][0] * td_gate_window[i];
+      tmp[i][1] = measured[ch][i][1] * td_gate_window[i];
+    }
+    for (; i < FFT_SIZE; i++) {
+      tmp[i][0] = 0.0;
+      tmp[i][1] = 0.0;
+    }
+    fft_inverse(tmp);
+    for (i = 0; i < FFT_SIZE; i++) {
+      tmp[i][0] *= td_gate[i];
+      tmp[i][1] *= td_gate[i];
+    }
+    fft_forward(tmp);
+    for (i = 0; i < sweep_points; i++) {
+      measured[ch][i][0] = tmp[i][0] * td_gate_norm[i][0] - tmp[i][1] * td_gate_norm[i][1];
+      measured[ch][i][1] = tmp[i][0] * td_gate_norm[i][1] + tmp[i][1] * td_gate_norm[i][0];
+    }
+  }
+}
+#endif
+
+#ifdef NANOVNA_F303
+// scratch for lowpass transforms, so that they need no spi_buffer (and LCD lock)
+static float td_buffer[FFT_SIZE/2][2];
+#endif
+
 static void transform_domain(void)
 {
     if ((domain_mode & DOMAIN_MODE) != DOMAIN_TIME) return; // nothing to do for freq domain
-  
+
+    uint8_t is_lowpass = (domain_mode & TD_FUNC) != TD_FUNC_BANDPASS;
+    update_td_window();
+
+#ifdef __TD_ZOOM__
+    if (TD_ZOOM_ENABLED()) {
+        transform_domain_zoom();
+        return;
+    }
+#endif
+#if POINT_COUNT >= FFT_SIZE/2
+#error CHECK ME
+#endif
+    if (is_lowpass) {
+        // hermitian symmetric spectrum gives real output: half size transform
+#ifdef NANOVNA_F303
+        float (*tmp)[2] = td_buffer;
+#else
+        chMtxLock(&mutex_ili9341); // [protect spi_buffer]
+        float (*tmp)[2] = (float(*)[2])spi_buffer;
+#endif
+        for (int ch = 0; ch < 2; ch++) {
+            for (int i = 0; i < sweep_points; i++) {
+                float w = td_window[i];
+                tmp[i][0] = measured[ch][i][0] * w;
+                tmp[i][1] = measured[ch][i][1] * w;
+            }
+            for (int i = sweep_points; i < FFT_SIZE/2; i++) {
+                tmp[i][0] = 0.0;
+                tmp[i][1] = 0.0;
+            }
+            tmp[0][1] = 0.0; // no component at nyquist frequency
+
+            fft_real_inverse(tmp, FFT_SIZE);
+            const float *x = (const float *)tmp;
+            for (int i = 0; i < POINT_COUNT; i++) {
+                measured[ch][i][0] = x[i] / (float)FFT_SIZE;
+                measured[ch][i][1] = 0.0;
+            }
+            if ( (domain_mode & TD_FUNC) == TD_FUNC_LOWPASS_STEP ) {
+                for (int i = 1; i < POINT_COUNT; i++) {
+                    measured[ch][i][0] += measured[ch][i-1][0];
+                }
+            }
+        }
+#ifndef NANOVNA_F303
+        chMtxUnlock(&mutex_ili9341); // [/protect spi_buffer]
+#endif
+        return;
+    }
+
     chMtxLock(&mutex_ili9341); // [protect spi_buffer]
     // use spi_buffer as temporary buffer
     // and calculate ifft for time domain
     float* tmp = (float*)spi_buffer;
 
-    uint8_t window_size = POINT_COUNT, offset = 0;
-    uint8_t is_lowpass = FALSE;
-    switch (domain_mode & TD_FUNC) {
-        case TD_FUNC_BANDPASS:
-            offset = 0;
-            window_size = POINT_COUNT;
-            break;
-        case TD_FUNC_LOWPASS_IMPULSE:
-        case TD_FUNC_LOWPASS_STEP:
-            is_lowpass = TRUE;
-            offset = POINT_COUNT;
-            window_size = POINT_COUNT * 2;
-            break;
-    }
-
-  float beta = 0.0;
-  switch (domain_mode & TD_WINDOW) {
-      case TD_WINDOW_MINIMUM:
-          beta = 0.0; // this is rectangular
-          break;
-      case TD_WINDOW_NORMAL:
-          beta = 6.0;
-          break;
-      case TD_WINDOW_MAXIMUM:
-          beta = 13;
-          break;
-  }
-
-
     for (int ch = 0; ch < 2; ch++) {
         memcpy(tmp, measured[ch], sizeof(measured[0]));
-        for (int i = 0; i < POINT_COUNT; i++) {
-            float w = kaiser_window(i+offset, window_size, beta);
+        for (int i = 0; i < sweep_points; i++) {
+            float w = td_window[i];
             tmp[i*2+0] *= w;
             tmp[i*2+1] *= w;
         }
-#if POINT_COUNT >= FFT_SIZE
-#error CHECK ME
-#endif
-        for (int i = POINT_COUNT; i < FFT_SIZE; i++) {
+        for (int i = sweep_points; i < FFT_SIZE; i++) {
             tmp[i*2+0] = 0.0;
             tmp[i*2+1] = 0.0;
         }
-        if (is_lowpass) {
-            for (int i = 1; i < POINT_COUNT; i++) {
-                tmp[(FFT_SIZE-i)*2+0] =  tmp[i*2+0];
-                tmp[(FFT_SIZE-i)*2+1] = -tmp[i*2+1];
-            }
-        }
 
-        fft256_inverse((float(*)[2])tmp);
+        fft_inverse((float(*)[2])tmp);
         memcpy(measured[ch], tmp, sizeof(measured[0]));
         for (int i = 0; i < POINT_COUNT; i++) {
             measured[ch][i][0] /= (float)FFT_SIZE;
-            if (is_lowpass) {
-                measured[ch][i][1] = 0.0;
-            } else {
-                measured[ch][i][1] /= (float)FFT_SIZE;
-            }
-        }
-        if ( (domain_mode & TD_FUNC) == TD_FUNC_LOWPASS_STEP ) {
-            for (int i = 1; i < POINT_COUNT; i++) {
-                measured[ch][i][0] += measured[ch][i-1][0];
-            }
+            measured[ch][i][1] /= (float)FFT_SIZE;
         }
     }
     chMtxUnlock(&mutex_ili9341); // [/protect spi_buffer]
@@ -251,7 +556,7 @@ static void cmd_resume(BaseSequentialStream *chp, int argc, char *argv[])
     chMtxLock(&mutex_sweep);
     update_frequencies();
     if (cal_auto_interpolate && (cal_status & CALSTAT_APPLY))
-        cal_interpolate(lastsaveid);
+        cal_interpolate_auto();
     chMtxUnlock(&mutex_sweep);
     resume_sweep();
 }
@@ -284,38 +589,57 @@ static void cmd_reset(BaseSequentialStream *chp, int argc, char *argv[])
 }
 
 # if 0
-static const int8_t gain_table[][2] = {
-    {  0,  0 },     // 1st: 0 ~ 300MHz
-    { 42, 40 },     // 2nd: 300 ~ 600MHz
-    { 52, 50 },     // 3rd: 600 ~ 900MHz
-    { 80, 78 },     // 4th: 900 ~ 1200MHz
-    { 90, 88 },     // 5th: 1200 ~ 1400MHz
-    { 95, 93 },     // 6th: 1400MHz ~
+static const harmonic_t harmonic_table[] = {
+    { 1, 1,  0,  0, 10 },     // 1st: 0 ~ 300MHz
+    { 3, 5, 42, 40, 10 },     // 2nd: 300 ~ 600MHz
+    { 3, 5, 52, 50, 10 },     // 3rd: 600 ~ 900MHz
+    { 5, 7, 80, 78, 10 },     // 4th: 900 ~ 1200MHz
+    { 5, 7, 90, 88, 10 },     // 5th: 1200 ~ 1400MHz
+    { 5, 7, 95, 93, 10 },     // 6th: 1400MHz ~
 };
 
 # endif
 
 //NanoVNA-H REV3.4
-static const int8_t gain_table[][2] = {
-    {  0,  0 },     // 1st: 0 ~ 300MHz
-    { 50, 50 },     // 2nd: 300 ~ 600MHz
-    { 55, 55 },     // 3rd: 600 ~ 900MHz
-    { 75, 75 },     // 4th: 900 ~ 1200MHz
-    { 80, 80 },     // 5th: 1200 ~ 1500MHz
-//  { 90, 90 },     // 6th: 1500MHz ~1800MHz
-//	{ 95, 95 },     // 7th: 1800MHz ~
+static const harmonic_t harmonic_table[] = {
+    { 1, 1,  0,  0, 10 },     // 1st: 0 ~ 300MHz
+    { 3, 5, 50, 50, 10 },     // 2nd: 300 ~ 600MHz
+    { 3, 5, 55, 55, 10 },     // 3rd: 600 ~ 900MHz
+    { 5, 7, 75, 75, 10 },     // 4th: 900 ~ 1200MHz
+    { 5, 7, 80, 80, 10 },     // 5th: 1200 ~ 1500MHz
+    { 7, 9, 90, 90, 10 },     // 6th: 1500MHz ~1800MHz
+    { 7, 9, 95, 95, 10 },     // 7th: 1800MHz ~
 };
+#define HARMONIC_ROWS (int)(sizeof harmonic_table / sizeof harmonic_table[0])
+
+const harmonic_t *get_harmonic(uint32_t freq)
+{
+  //Harmonics are switched after an integer multiple, and then the gain needs to be switched after an integer multiple.
+  uint32_t row = freq ? (freq-1) / FREQ_HARMONICS : 0;
+  if (row >= HARMONIC_ROWS)
+    row = HARMONIC_ROWS - 1;
+  return &harmonic_table[row];
+}
 
-static int adjust_gain(int newfreq)
+// rows sharing a gain need no codec write
+static int adjust_gain(uint32_t newfreq)
 {
-  int delay = 0;
-  int new_order = (newfreq-1) / FREQ_HARMONICS; //Harmonics are switched after an integer multiple, and then the gain needs to be switched after an integer multiple.
-  int old_order = (frequency-1) / FREQ_HARMONICS;
-  if (new_order != old_order) {
-    tlv320aic3204_set_gain(gain_table[new_order][0], gain_table[new_order][1]);
-    delay += 10;
+  const harmonic_t *new_row = get_harmonic(newfreq);
+  const harmonic_t *old_row = get_harmonic(frequency);
+  if (new_row->lgain != old_row->lgain || new_row->rgain != old_row->rgain) {
+    tlv320aic3204_set_gain(new_row->lgain, new_row->rgain);
+    return new_row->settle;
   }
-  return delay;
+  return 0;
+}
+
+static uint8_t get_drive_strength(uint32_t freq)
+{
+    int8_t ds = drive_strength;
+    if (ds == DRIVE_STRENGTH_AUTO) {
+      ds = freq > FREQ_HARMONICS ? SI5351_CLK_DRIVE_STRENGTH_8MA : SI5351_CLK_DRIVE_STRENGTH_2MA;
+    }
+    return ds;
 }
 
 static int set_frequency(uint32_t freq)
@@ -325,16 +649,60 @@ static int set_frequency(uint32_t freq)
       return delay;
 
     delay += adjust_gain(freq);
+    delay += si5351_set_frequency_with_offset(freq, frequency_offset, get_drive_strength(freq));
 
-    int8_t ds = drive_strength;
-    if (ds == DRIVE_STRENGTH_AUTO) {
-      ds = freq > FREQ_HARMONICS ? SI5351_CLK_DRIVE_STRENGTH_8MA : SI5351_CLK_DRIVE_STRENGTH_2MA;
+    frequency = freq;
+    return delay;
+}
+
+#ifdef __SI5351_PLAN__
+/*
+ * Synthesizer registers of every sweep point. Planned when the frequencies
+ * change, or when the span, points, offset, drive strength or harmonic
+ * threshold differ from the values the plan was made with.
+ */
+static si5351_plan_t sweep_plan[POINT_COUNT];
+float frequency_error[POINT_COUNT][2];
+static bool sweep_plan_valid = false;
+static uint32_t sweep_plan_start;
+static uint32_t sweep_plan_stop;
+static int16_t sweep_plan_points;
+static int32_t sweep_plan_offset;
+static int8_t sweep_plan_drive;
+static uint32_t sweep_plan_threshold;
+
+static void update_sweep_plan(void)
+{
+    for (int i = 0; i < sweep_points; i++) {
+      si5351_plan_frequency(&sweep_plan[i], frequencies[i], frequency_offset, get_drive_strength(frequencies[i]));
+      si5351_plan_error(&sweep_plan[i], frequencies[i], frequency_offset,
+                        &frequency_error[i][0], &frequency_error[i][1]);
     }
-    delay += si5351_set_frequency_with_offset(freq, frequency_offset, ds);
+    sweep_plan_start = frequencies[0];
+    sweep_plan_stop = frequencies[sweep_points-1];
+    sweep_plan_points = sweep_points;
+    sweep_plan_offset = frequency_offset;
+    sweep_plan_drive = drive_strength;
+    sweep_plan_threshold = config.harmonic_freq_threshold;
+    sweep_plan_valid = true;
+}
+
+static int set_frequency_at(int i)
+{
+    uint32_t freq = frequencies[i];
+    int delay = 0;
+    if (frequency == freq)
+      return delay;
+
+    delay += adjust_gain(freq);
+    delay += si5351_apply_plan(&sweep_plan[i]);
 
     frequency = freq;
     return delay;
 }
+#else
+#define set_frequency_at(i) set_frequency(frequencies[i])
+#endif
 
 static void cmd_offset(BaseSequentialStream *chp, int argc, char *argv[])
 {
@@ -459,6 +827,8 @@ float measured[2][POINT_COUNT][2];
 
 static void wait_dsp(int count)
 {
+  // settling counts from when the register writes are on the chips
+  i2c_flush();
   wait_count = count;
   //reset_dsp_accumerator();
   while (wait_count)
@@ -574,33 +944,77 @@ static void cmd_dump(BaseSequentialStream *chp, int argc, char *argv[])
 }
 #endif
 
+/*
+ * Pack line of pixels (big endian) with run length encoding:
+ *  header bit7 = 1: next pixel repeated (header&0x7f)+1 times
+ *  header bit7 = 0: header+1 literal pixels follow
+ */
+static int capture_rle(const uint16_t *p, int n, uint8_t *out)
+{
+  uint8_t *o = out;
+  while (n > 0) {
+    int run = 1;
+    while (run < n && run < 128 && p[run] == p[0])
+      run++;
+    if (run > 1) {
+      *o++ = 0x80 | (run - 1);
+      *o++ = p[0] >> 8;
+      *o++ = p[0];
+    } else {
+      // literal until next run of 2 starts
+      while (run < n && run < 128 && !(run+1 < n && p[run] == p[run+1]))
+        run++;
+      *o++ = run - 1;
+      int i;
+      for (i = 0; i < run; i++) {
+        *o++ = p[i] >> 8;
+        *o++ = p[i];
+      }
+    }
+    p += run;
+    n -= run;
+  }
+  return o - out;
+}
+
 static void cmd_capture(BaseSequentialStream *chp, int argc, char *argv[])
 {
-// read pixel count at one time (PART*2 bytes required for read buffer)
+// read pixel count at one time (one line)
 #define PART LCD_WIDTH
+// read buffer needs 3 bytes per pixel (18bit read), output follows it
+#define CAPTURE_OUT_OFFSET ((PART*3+1)/2)
+#if CAPTURE_OUT_OFFSET + PART + (PART+127)/128 > SPI_BUFFER_SIZE
+#error "spi_buffer too small for capture"
+#endif
+    bool rle = FALSE;
+    if (argc == 1 && strcmp(argv[0], "rle") == 0) {
+      rle = TRUE;
+    } else if (argc != 0) {
+      chprintf(chp, "usage: capture [rle]\r\n");
+      return;
+    }
 
     chMtxLock(&mutex_ili9341); // [capture display + spi_buffer]
 
-    // use uint16_t spi_buffer[1024] (defined in ili9341) for read buffer
+    // use spi_buffer (defined in ili9341) for read and output buffer
     uint16_t *buf = &spi_buffer[0];
-    int len = LCD_WIDTH * LCD_HEIGHT;
-    int i;
-    ili9341_read_memory(0, 0, LCD_WIDTH, LCD_HEIGHT, PART, buf);
-    for (i = 0; i < PART; i++) {
-        streamPut(chp, buf[i] >> 8);
-        streamPut(chp, buf[i] & 0xff);
-    }
-
-    len -= PART;
-    while (len > 0) {
-        ili9341_read_memory_continue(PART, buf);
-        for (i = 0; i < PART; i++) {
-            streamPut(chp, buf[i] >> 8);
-            streamPut(chp, buf[i] & 0xff);
+    uint8_t *out = (uint8_t *)&spi_buffer[CAPTURE_OUT_OFFSET];
+    int y, i, n;
+    for (y = 0; y < LCD_HEIGHT; y++) {
+        if (y == 0)
+          ili9341_read_memory(0, 0, LCD_WIDTH, LCD_HEIGHT, PART, buf);
+        else
+          ili9341_read_memory_continue(PART, buf);
+        if (rle) {
+          n = capture_rle(buf, PART, out);
+        } else {
+          for (i = 0, n = 0; i < PART; i++) {
+            out[n++] = buf[i] >> 8;
+            out[n++] = buf[i] & 0xff;
+          }
         }
-        len -= PART;
+        streamWrite(chp, out, n);
     }
-    //*/
 
     chMtxUnlock(&mutex_ili9341); // [/capture display + spi_buffer]
 }
@@ -690,6 +1104,7 @@ properties_t volatile current_props = {
   ._active_marker =        0,
   ._domain_mode =          0,
   ._velocity_factor =     70,
+  ._kaiser_beta =         60,
   .checksum =              0
 };
 volatile properties_t *active_props = &current_props;
@@ -703,49 +1118,223 @@ static void ensure_edit_config(void)
   active_props = &current_props;
   // move to uncal state
   cal_status = 0;
+  cal_segments = 0;
+}
+
+static void apply_corrections_at(int i)
+{
+    if (cal_status & CALSTAT_APPLY)
+        apply_error_term_at(i);
+
+    if (electrical_delay != 0)
+      apply_edelay_at(i);
+}
+
+#ifdef __CODEC_PROFILE__
+/*
+ * Codec sample rate, 48kHz << codec_profile. The IF offset follows the
+ * rate so every block still holds five IF cycles and the sincos table
+ * of dsp.c fits all profiles. Blocks get shorter, settle_blocks keeps
+ * the settling beyond the 3 block pipeline in time.
+ */
+static uint8_t codec_profile = 0;
+
+// mutex_sweep must be held
+static void set_codec_profile(int profile)
+{
+  i2sStopExchange(&I2SD2);
+  tlv320aic3204_set_rate(profile);
+  frequency_offset = frequency_offset / (1 << codec_profile) * (1 << profile);
+  codec_profile = profile;
+  i2c_flush();
+  i2sStartExchange(&I2SD2);
+  si5351_set_frequency_with_offset(frequency, frequency_offset, get_drive_strength(frequency));
 }
+#endif
+
+// blocks to wait for a settling delay in ms (at 48kHz one block is 1ms)
+static int settle_blocks(int delay)
+{
+  delay = delay < 3 ? 3 : delay;
+  delay = delay > 8 ? 8 : delay;
+#ifdef __CODEC_PROFILE__
+  // 3 blocks of pipeline (partial, filter transient, measured) scale
+  // with the rate, synthesizer and gain settling beyond them is time
+  delay = 3 + ((delay - 3) << codec_profile);
+#endif
+  return delay;
+}
+
+#ifdef __GAIN_AUTO__
+/*
+ * Receiver gain ranging. The sample (right) MICPGA runs at the harmonic
+ * row's gain plus the offset of a range, picked per point and channel
+ * from the peak sample and IF level and kept for the next sweep. The
+ * reference gain is left alone, so results are divided by the offset's
+ * gain to keep them on the scale of the row's gain.
+ */
+#define GAIN_RANGE_MIN   -1       // ranges are offsets from the row's gain
+#define GAIN_RANGE_MAX   2
+#define GAIN_RANGE_STEP  24       // MICPGA units (0.5dB) between ranges
+#define GAIN_CLIP_PEAK   30000    // step down at this peak sample
+#define GAIN_LOW_LEVEL   2000     // step up below this IF amplitude
+#define GAIN_RETRIES     2
+
+static bool gain_auto = false;
+static float gain_unit_db = 0.5;  // MICPGA step, see gain auto cal
+static int8_t gain_range[2][POINT_COUNT];
+static uint16_t gain_steps = 0;
+static uint16_t sweep_gain_steps = 0; // range changes in the last full sweep
+
+static void reset_gain_range(void)
+{
+  memset(gain_range, 0, sizeof gain_range);
+}
+
+// MICPGA setting of range at the current frequency
+static int sample_gain(int range)
+{
+  int gain = get_harmonic(frequency)->rgain + range * GAIN_RANGE_STEP;
+  return gain < 0 ? 0 : gain > 95 ? 95 : gain;
+}
+
+static void set_sample_gain(int gain)
+{
+  tlv320aic3204_set_gain(get_harmonic(frequency)->lgain, gain);
+}
+
+static void measure_at(int ch, int i, int delay)
+{
+  if (!gain_auto) {
+    wait_dsp(delay);
+    (*sample_func)(measured[ch][i]);
+    return;
+  }
+  int range = gain_range[ch][i];
+  int gain = sample_gain(range);
+  set_sample_gain(gain);
+  wait_dsp(delay);
+  for (int n = 0; n < GAIN_RETRIES; n++) {
+    int next = range;
+    if (sample_peak() >= GAIN_CLIP_PEAK)
+      next--;
+    else if (sample_level() < GAIN_LOW_LEVEL)
+      next++;
+    // out of ranges, or the MICPGA is at its end
+    if (next < GAIN_RANGE_MIN || next > GAIN_RANGE_MAX || sample_gain(next) == gain)
+      break;
+    range = next;
+    gain = sample_gain(range);
+    set_sample_gain(gain);
+    gain_steps++;
+    wait_dsp(delay);
+  }
+  gain_range[ch][i] = range;
+  (*sample_func)(measured[ch][i]);
+  int units = gain - get_harmonic(frequency)->rgain;
+  if (units != 0 && sample_func != fetch_amplitude_ref) {
+    float scale = powf(10, -units * gain_unit_db / 20);
+    measured[ch][i][0] *= scale;
+    measured[ch][i][1] *= scale;
+  }
+}
+
+/*
+ * Measure the MICPGA step at the current frequency from the transmission
+ * amplitude at the base gain and one range away, with a thru connected.
+ */
+static bool gain_calibrate(void)
+{
+  float a[2][2];
+  int base = get_harmonic(frequency)->rgain;
+  int gain = sample_gain(base >= GAIN_RANGE_STEP ? -1 : 1);
+  tlv320aic3204_select(1);
+  for (int n = 0; n < 2; n++) {
+    set_sample_gain(n ? gain : base);
+    wait_dsp(8);
+    if (sample_peak() >= GAIN_CLIP_PEAK || sample_level() < GAIN_LOW_LEVEL)
+      break;
+    fetch_amplitude(a[n]);
+    if (n == 0)
+      continue;
+    float db = 10 * log10f((a[1][0] * a[1][0] + a[1][1] * a[1][1])
+                          / (a[0][0] * a[0][0] + a[0][1] * a[0][1])) / (gain - base);
+    if (db < 0.25 || db > 1.0)
+      break;
+    gain_unit_db = db;
+    set_sample_gain(base);
+    return true;
+  }
+  set_sample_gain(base);
+  return false;
+}
+#else
+static void measure_at(int ch, int i, int delay)
+{
+  wait_dsp(delay);
+  (*sample_func)(measured[ch][i]);
+}
+#endif
 
 // main loop for measurement
 static bool sweep(bool break_on_operation)
 {
+    uint32_t i2c_start_bytes = i2c_bytes;
+#ifdef __GAIN_AUTO__
+    uint16_t gain_start_steps = gain_steps;
+#endif
     pll_lock_failed = false;
+#ifdef __SI5351_PLAN__
+    if (!sweep_plan_valid
+        || sweep_plan_points != sweep_points
+        || sweep_plan_start != frequencies[0]
+        || sweep_plan_stop != frequencies[sweep_points-1]
+        || sweep_plan_offset != frequency_offset
+        || sweep_plan_drive != drive_strength
+        || sweep_plan_threshold != config.harmonic_freq_threshold)
+      update_sweep_plan();
+#endif
     for (int i = 0; i < sweep_points; i++) {
-        int delay = set_frequency(frequencies[i]);
-        delay = delay < 3 ? 3 : delay;
-        delay = delay > 8 ? 8 : delay;
+        int delay = settle_blocks(set_frequency_at(i));
     
         tlv320aic3204_select(0); // CH0:REFLECT
-        wait_dsp(delay);
+
+        // correct the previous point while the register writes are sent
+        if (i > 0)
+            apply_corrections_at(i - 1);
 
         /* calculate reflection coeficient */
-        (*sample_func)(measured[0][i]);
+        measure_at(0, i, delay);
 
         tlv320aic3204_select(1); // CH1:TRANSMISSION
-        wait_dsp(delay);
 
         /* calculate transmission coeficient */
-        (*sample_func)(measured[1][i]);
-
-        if (cal_status & CALSTAT_APPLY)
-            apply_error_term_at(i);
-
-    if (electrical_delay != 0)
-      apply_edelay_at(i);
+        measure_at(1, i, delay);
 
     // back to toplevel to handle ui operation
-    if (operation_requested && break_on_operation)
+    if (operation_requested && break_on_operation) {
+      apply_corrections_at(i);
       return false;
+    }
+  }
+  if (sweep_points > 0) {
+    apply_corrections_at(sweep_points - 1);
+    sweep_i2c_bytes = (i2c_bytes - i2c_start_bytes) / sweep_points;
+#ifdef __GAIN_AUTO__
+    sweep_gain_steps = gain_steps - gain_start_steps;
+#endif
   }
 
+#ifdef __TD_GATE__
+  gate_domain();
+#endif
   transform_domain();
   return true;
 }
 
 #ifdef __SCANRAW_CMD__
 static void measure_gamma_avg(uint8_t channel, uint32_t freq, uint16_t avg_count, float* gamma) {
-    int delay = set_frequency(freq);
-    delay = delay < 3 ? 3 : delay;
-    delay = delay > 8 ? 8 : delay;
+    int delay = settle_blocks(set_frequency(freq));
     
     tlv320aic3204_select(channel);
     wait_dsp(delay);
@@ -859,7 +1448,7 @@ static void cmd_scan(BaseSequentialStream *chp, int argc, char *argv[])
   chMtxLock(&mutex_sweep);
   set_frequencies(start, stop, points);
   if (cal_auto_interpolate && (cal_status & CALSTAT_APPLY))
-    cal_interpolate(lastsaveid);
+    cal_interpolate_auto();
 
   sweep_once = TRUE;
   chMtxUnlock(&mutex_sweep);
@@ -911,10 +1500,16 @@ static void set_frequencies(uint32_t start, uint32_t stop, int16_t points)
   // disable at out of sweep range
   for (; i < sweep_points; i++)
     frequencies[i] = 0;
+#ifdef __SI5351_PLAN__
+  update_sweep_plan();
+#endif
+#ifdef __GAIN_AUTO__
+  reset_gain_range();
+#endif
   chMtxUnlock(&mutex_sweep);
 }
 
-static void update_frequencies(void)
+void update_frequencies(void)
 {
   chMtxLock(&mutex_sweep);
   uint32_t start, stop;
@@ -955,7 +1550,7 @@ static void freq_mode_centerspan(void)
     int start = frequency0;
     int stop = frequency1;
     ensure_edit_config();
-    frequency0 = (start + stop)/2; // center
+    frequency0 = start + (stop - start)/2; // center, start + stop may pass int32
     frequency1 = -(stop - start); // span
   }
 }
@@ -1004,11 +1599,11 @@ void set_sweep_frequency(int type, int32_t freq)
     frequency0 = freq;
     center = frequency0;
     span = -frequency1;
-    if (center-span/2 < START_MIN) {
+    if (center < START_MIN + span/2) {
       span = (center - START_MIN) * 2;
       frequency1 = -span;
     }
-    if (center+span/2 > STOP_MAX) {
+    if (center > STOP_MAX - span/2) {
       span = (STOP_MAX - center) * 2;
       frequency1 = -span;
     }
@@ -1024,11 +1619,11 @@ void set_sweep_frequency(int type, int32_t freq)
     frequency1 = -freq;
     center = frequency0;
     span = -frequency1;
-    if (center-span/2 < START_MIN) {
+    if (center < START_MIN + span/2) {
       center = START_MIN + span/2;
       frequency0 = center;
     }
-    if (center+span/2 > STOP_MAX) {
+    if (center > STOP_MAX - span/2) {
       center = STOP_MAX - span/2;
       frequency0 = center;
     }
@@ -1048,7 +1643,7 @@ void set_sweep_frequency(int type, int32_t freq)
   }
 
   if (cal_auto_interpolate && cal_applied)
-    cal_interpolate(lastsaveid);
+    cal_interpolate_auto();
   chMtxUnlock(&mutex_sweep);
 }
 
@@ -1058,9 +1653,9 @@ uint32_t get_sweep_frequency(int type)
     switch (type) {
     case ST_START: return frequency0;
     case ST_STOP: return frequency1;
-    case ST_CENTER: return (frequency0 + frequency1)/2;
+    case ST_CENTER: return frequency0 + (frequency1 - frequency0)/2;
     case ST_SPAN: return frequency1 - frequency0;
-    case ST_CW: return (frequency0 + frequency1)/2;
+    case ST_CW: return frequency0 + (frequency1 - frequency0)/2;
     }
   } else {
     switch (type) {
@@ -1308,7 +1903,13 @@ static void apply_error_term_at(int i)
 
 static void apply_edelay_at(int i)
 {
+#ifdef __SI5351_PLAN__
+  // phase of the delivered frequency, whole turns removed before going to float
+  double turns = electrical_delay * 1E-12 * (frequencies[i] + (double)frequency_error[i][0]);
+  float w = 2 * M_PI * (turns - floor(turns));
+#else
   float w = 2 * M_PI * electrical_delay * frequencies[i] * 1E-12;
+#endif
   float s = sin(w);
   float c = cos(w);
   float real = measured[0][i][0];
@@ -1362,6 +1963,8 @@ void cal_done(void)
 {
   chMtxLock(&mutex_sweep);
   ensure_edit_config();
+  // a new calibration, saved segments no longer belong to it
+  cal_segments = 0;
   if (!(cal_status & CALSTAT_LOAD))
     eterm_set(ETERM_ED, 0.0, 0.0);
   //adjust_ed();
@@ -1394,12 +1997,64 @@ void cal_done(void)
   chMtxUnlock(&mutex_sweep);
 }
 
+// interpolate cal_data at sweep point i from saved calibration src
+static void cal_interpolate_at(const properties_t *src, int i)
+{
+  int n = src->_sweep_points;
+  uint32_t f = frequencies[i];
+  int j = 0;
+  int eterm;
+  float k1 = 0.0;
+
+  if (n > POINT_COUNT)
+    n = POINT_COUNT;
+  if (n < 2 || f <= src->_frequencies[0]) {
+    // lower than start freq of src range: fill cal_data at head
+    j = 0;
+  } else if (f >= src->_frequencies[n-1]) {
+    // upper than end freq of src range: fill cal_data at tail
+    j = n - 2;
+    k1 = 1.0;
+  } else {
+    // find f between freqs at j and j+1
+    int hi = n - 1;
+    while (hi - j > 1) {
+      int mid = (j + hi) / 2;
+      if (src->_frequencies[mid] <= f)
+        j = mid;
+      else
+        hi = mid;
+    }
+    k1 = (float)(f - src->_frequencies[j])
+           / (src->_frequencies[j+1] - src->_frequencies[j]);
+
+    // avoid glitch between freqs in different harmonics mode
+    if (IS_HARMONIC_MODE(src->_frequencies[j]) != IS_HARMONIC_MODE(src->_frequencies[j+1])) {
+      // assume f[j] < f[j+1]
+      k1 = IS_HARMONIC_MODE(f) ? 1.0 : 0.0;
+    }
+  }
+
+  if (n < 2) {
+    for (eterm = 0; eterm < 5; eterm++) {
+      cal_data[eterm][i][0] = src->_cal_data[eterm][0][0];
+      cal_data[eterm][i][1] = src->_cal_data[eterm][0][1];
+    }
+    return;
+  }
+
+  float k0 = 1.0 - k1;
+  for (eterm = 0; eterm < 5; eterm++) {
+    cal_data[eterm][i][0] = src->_cal_data[eterm][j][0] * k0 + src->_cal_data[eterm][j+1][0] * k1;
+    cal_data[eterm][i][1] = src->_cal_data[eterm][j][1] * k0 + src->_cal_data[eterm][j+1][1] * k1;
+  }
+}
+
 static void cal_interpolate(int s)
 {
   chMtxLock(&mutex_sweep);
   const properties_t *src = caldata_ref(s);
-  int i, j;
-  int eterm;
+  int i;
   if (src == NULL) {
     chMtxUnlock(&mutex_sweep);
     return;
@@ -1407,60 +2062,83 @@ static void cal_interpolate(int s)
 
   ensure_edit_config();
 
-  // lower than start freq of src range
-  for (i = 0; i < sweep_points; i++) {
-    if (frequencies[i] >= src->_frequencies[0])
-      break;
+  for (i = 0; i < sweep_points; i++)
+    cal_interpolate_at(src, i);
 
-    // fill cal_data at head of src range
-    for (eterm = 0; eterm < 5; eterm++) {
-      cal_data[eterm][i][0] = src->_cal_data[eterm][0][0];
-      cal_data[eterm][i][1] = src->_cal_data[eterm][0][1];
-    }
-  }
+  cal_status |= src->_cal_status | CALSTAT_APPLY | CALSTAT_INTERPOLATED;
+  redraw_request |= REDRAW_CAL_STATUS;  
+  chMtxUnlock(&mutex_sweep);
+}
 
-  j = 0;
-  for (; i < sweep_points; i++) {
+/*
+ * Segmented calibration: the save slots in cal_segments hold dense
+ * calibrations of adjacent (or overlapping) sub ranges. Each sweep point
+ * is assigned to the densest segment covering it, or to the nearest one
+ * when no segment covers it.
+ */
+static void cal_build_segment_index(void)
+{
+  int i, s;
+  for (i = 0; i < sweep_points; i++) {
     uint32_t f = frequencies[i];
-
-    for (; j < sweep_points-1; j++) {
-      if (src->_frequencies[j] <= f && f < src->_frequencies[j+1]) {
-        // found f between freqs at j and j+1
-        float k1 = (float)(f - src->_frequencies[j])
-                        / (src->_frequencies[j+1] - src->_frequencies[j]);
-        
-        // avoid glitch between freqs in different harmonics mode
-        if (IS_HARMONIC_MODE(src->_frequencies[j]) != IS_HARMONIC_MODE(src->_frequencies[j+1])) {
-          // assume f[j] < f[j+1]
-          k1 = IS_HARMONIC_MODE(f) ? 1.0 : 0.0;
-        }
-
-        float k0 = 1.0 - k1;
-        for (eterm = 0; eterm < 5; eterm++) {
-          cal_data[eterm][i][0] = src->_cal_data[eterm][j][0] * k0 + src->_cal_data[eterm][j+1][0] * k1;
-          cal_data[eterm][i][1] = src->_cal_data[eterm][j][1] * k0 + src->_cal_data[eterm][j+1][1] * k1;
-        }
-        break;
+    uint32_t best_step = 0xffffffff;
+    uint32_t best_dist = 0xffffffff;
+    int8_t best = -1;
+    for (s = 0; s < SAVEAREA_MAX; s++) {
+      if (!(cal_segments & (1<<s)))
+        continue;
+      const properties_t *src = caldata_ref(s);
+      // a single point has no spacing to compare
+      if (src == NULL || src->_sweep_points < 2 || src->_sweep_points > POINT_COUNT)
+        continue;
+      uint32_t lo = src->_frequencies[0];
+      uint32_t hi = src->_frequencies[src->_sweep_points-1];
+      uint32_t step = (hi - lo) / (src->_sweep_points - 1);
+      uint32_t dist = f < lo ? lo - f : f > hi ? f - hi : 0;
+      if (dist < best_dist || (dist == 0 && step < best_step)) {
+        best = s;
+        best_dist = dist;
+        best_step = step;
       }
     }
-    if (j == sweep_points-1)
-      break;
+    cal_segment_index[i] = best;
   }
-  
-  // upper than end freq of src range
-  for (; i < sweep_points; i++) {
-    // fill cal_data at tail of src
-    for (eterm = 0; eterm < 5; eterm++) {
-      cal_data[eterm][i][0] = src->_cal_data[eterm][sweep_points-1][0];
-      cal_data[eterm][i][1] = src->_cal_data[eterm][sweep_points-1][1];
-    }
+}
+
+static void cal_interpolate_segments(void)
+{
+  chMtxLock(&mutex_sweep);
+  int i;
+  uint16_t status = 0;
+
+  cal_build_segment_index();
+  if (cal_segment_index[0] < 0) {
+    // no valid segment
+    chMtxUnlock(&mutex_sweep);
+    return;
   }
-    
-  cal_status |= src->_cal_status | CALSTAT_APPLY | CALSTAT_INTERPOLATED;
-  redraw_request |= REDRAW_CAL_STATUS;  
+
+  ensure_edit_config();
+
+  for (i = 0; i < sweep_points; i++) {
+    const properties_t *src = caldata_ref(cal_segment_index[i]);
+    cal_interpolate_at(src, i);
+    status |= src->_cal_status;
+  }
+
+  cal_status |= status | CALSTAT_APPLY | CALSTAT_INTERPOLATED;
+  redraw_request |= REDRAW_CAL_STATUS;
   chMtxUnlock(&mutex_sweep);
 }
 
+static void cal_interpolate_auto(void)
+{
+  if (cal_segments)
+    cal_interpolate_segments();
+  else
+    cal_interpolate(lastsaveid);
+}
+
 static void cmd_cal(BaseSequentialStream *chp, int argc, char *argv[])
 {
   const char *items[] = { "load", "open", "short", "thru", "isoln", "Es", "Er", "Et", "cal'ed" };
@@ -1508,6 +2186,7 @@ static void cmd_cal(BaseSequentialStream *chp, int argc, char *argv[])
   } else if (strcmp(cmd, "reset") == 0) {
     chMtxLock(&mutex_sweep);
     cal_status = 0;
+    cal_segments = 0;
     redraw_request |= REDRAW_CAL_STATUS;
     chMtxUnlock(&mutex_sweep);
     return;
@@ -1522,11 +2201,37 @@ static void cmd_cal(BaseSequentialStream *chp, int argc, char *argv[])
     int s = 0;
     if (argc > 1)
       s = atoi(argv[1]);
+    cal_segments = 0;
     cal_interpolate(s);
     redraw_request |= REDRAW_CAL_STATUS;
     return;
+  } else if (strcmp(cmd, "seg") == 0) {
+    uint8_t segments = 0;
+    int i;
+    if (argc == 1) {
+      for (i = 0; i < SAVEAREA_MAX; i++)
+        if (cal_segments & (1<<i))
+          chprintf(chp, "%d ", i);
+      chprintf(chp, "\r\n");
+      return;
+    }
+    if (argc == 2 && strcmp(argv[1], "off") == 0) {
+      cal_segments = 0;
+      return;
+    }
+    for (i = 1; i < argc; i++) {
+      int s = atoi(argv[i]);
+      if (s < 0 || s >= SAVEAREA_MAX || caldata_ref(s) == NULL || caldata_ref(s)->_sweep_points < 2) {
+        chprintf(chp, "invalid segment %d\r\n", s);
+        return;
+      }
+      segments |= 1<<s;
+    }
+    cal_segments = segments;
+    cal_interpolate_segments();
+    return;
   } else {
-    chprintf(chp, "usage: cal [load|open|short|thru|isoln|done|reset|on|off|in]\r\n");
+    chprintf(chp, "usage: cal [load|open|short|thru|isoln|done|reset|on|off|in|seg]\r\n");
     return;
   }
 }
@@ -1554,7 +2259,8 @@ static void cmd_recall(BaseSequentialStream *chp, int argc, char *argv[])
     pause_sweep();
     chMtxLock(&mutex_sweep);
     if (caldata_recall(id) == 0) {
-        // success
+        // success, the recalled set replaces any segments
+        cal_segments = 0;
         update_frequencies();
         redraw_request |= REDRAW_CAL_STATUS;
     }
@@ -1888,6 +2594,16 @@ static void cmd_frequencies(BaseSequentialStream *chp, int argc, char *argv[])
 {
   int i;
   (void)chp;
+#ifdef __SI5351_PLAN__
+  if (argc == 1 && strcmp(argv[0], "exact") == 0) {
+    // requested frequency, RF and LO error of the delivered frequencies (Hz)
+    for (i = 0; i < sweep_points; i++) {
+      if (frequencies[i] != 0)
+        chprintf(chp, "%d %f %f\r\n", frequencies[i], frequency_error[i][0], frequency_error[i][1]);
+    }
+    return;
+  }
+#endif
   (void)argc;
   (void)argv;
   for (i = 0; i < sweep_points; i++) {
@@ -1909,11 +2625,42 @@ static void set_timedomain_func(int func) // accept TD_FUNC_LOWPASS_IMPULSE, TD_
   domain_mode = (domain_mode & ~TD_FUNC) | (func & TD_FUNC);
 }
 
-static void set_timedomain_window(int func) // accept TD_WINDOW_MINIMUM/TD_WINDOW_NORMAL/TD_WINDOW_MAXIMUM
+static void set_timedomain_window(int func) // accept TD_WINDOW_XXX
 {
   domain_mode = (domain_mode & ~TD_WINDOW) | (func & TD_WINDOW);
 }
 
+static void set_timedomain_kaiser_beta(float beta)
+{
+  if (beta < 0.0)
+    beta = 0.0;
+  if (beta > 25.5)
+    beta = 25.5;
+  kaiser_beta = beta * 10 + 0.5;
+}
+
+#ifdef __TD_ZOOM__
+static void set_timedomain_zoom(float start, float stop) // seconds
+{
+  chMtxLock(&mutex_sweep);
+  td_zoom_start = start;
+  td_zoom_stop = stop;
+  chMtxUnlock(&mutex_sweep);
+  redraw_request |= REDRAW_FREQUENCY;
+}
+#endif
+
+#ifdef __TD_GATE__
+static void set_timedomain_gate(float start, float stop, uint8_t shape) // seconds
+{
+  chMtxLock(&mutex_sweep);
+  td_gate_start = start;
+  td_gate_stop = stop;
+  td_gate_shape = shape;
+  chMtxUnlock(&mutex_sweep);
+}
+#endif
+
 static void cmd_transform(BaseSequentialStream *chp, int argc, char *argv[])
 {
   int i;
@@ -1939,6 +2686,65 @@ static void cmd_transform(BaseSequentialStream *chp, int argc, char *argv[])
       set_timedomain_window(TD_WINDOW_NORMAL);
     } else if (strcmp(cmd, "maximum") == 0) {
       set_timedomain_window(TD_WINDOW_MAXIMUM);
+    } else if (strcmp(cmd, "hann") == 0) {
+      set_timedomain_window(TD_WINDOW_HANN);
+    } else if (strcmp(cmd, "blackman") == 0) {
+      set_timedomain_window(TD_WINDOW_BLACKMAN_HARRIS);
+    } else if (strcmp(cmd, "kaiser") == 0) {
+      // optional beta follows
+      if (i + 1 < argc && (isdigit((int)argv[i+1][0]) || argv[i+1][0] == '.'))
+        set_timedomain_kaiser_beta(my_atof(argv[++i]));
+      set_timedomain_window(TD_WINDOW_KAISER);
+#ifdef __TD_ZOOM__
+    } else if (strcmp(cmd, "zoom") == 0 || strcmp(cmd, "range") == 0) {
+      // zoom {start(ns)} {stop(ns)}, range {start(m)} {stop(m)} or off
+      if (i + 1 < argc && strcmp(argv[i+1], "off") == 0) {
+        i++;
+        set_timedomain_zoom(0.0, 0.0);
+        continue;
+      }
+      if (i + 2 >= argc)
+        goto usage;
+      float start = my_atof(argv[i+1]);
+      float stop = my_atof(argv[i+2]);
+      i += 2;
+      if (stop <= start)
+        goto usage;
+      if (cmd[0] == 'r') {
+        // distance to round trip time
+        float scale = 2.0 / (SPEED_OF_LIGHT * (velocity_factor / 100.0));
+        set_timedomain_zoom(start * scale, stop * scale);
+      } else {
+        set_timedomain_zoom(start * 1e-9, stop * 1e-9);
+      }
+#endif
+#ifdef __TD_GATE__
+    } else if (strcmp(cmd, "gate") == 0) {
+      // gate {start(ns)} {stop(ns)} [rect|normal|wide] or off
+      if (i + 1 < argc && strcmp(argv[i+1], "off") == 0) {
+        i++;
+        set_timedomain_gate(0.0, 0.0, td_gate_shape);
+        continue;
+      }
+      if (i + 2 >= argc)
+        goto usage;
+      float start = my_atof(argv[i+1]) * 1e-9;
+      float stop = my_atof(argv[i+2]) * 1e-9;
+      uint8_t shape = td_gate_shape;
+      i += 2;
+      if (stop <= start)
+        goto usage;
+      if (i + 1 < argc) {
+        if (strcmp(argv[i+1], "rect") == 0) {
+          shape = GATE_SHAPE_RECT; i++;
+        } else if (strcmp(argv[i+1], "normal") == 0) {
+          shape = GATE_SHAPE_NORMAL; i++;
+        } else if (strcmp(argv[i+1], "wide") == 0) {
+          shape = GATE_SHAPE_WIDE; i++;
+        }
+      }
+      set_timedomain_gate(start, stop, shape);
+#endif
     } else {
       goto usage;
     }
@@ -1946,7 +2752,13 @@ static void cmd_transform(BaseSequentialStream *chp, int argc, char *argv[])
   return;
 
 usage:
-  chprintf(chp, "usage: transform {on|off|impulse|step|bandpass|minimum|normal|maximum} [...]\r\n");
+  chprintf(chp, "usage: transform {on|off|impulse|step|bandpass|minimum|normal|maximum|hann|blackman|kaiser [beta]} [...]\r\n");
+#ifdef __TD_ZOOM__
+  chprintf(chp, "       transform {zoom {start(ns)} {stop(ns)}|range {start(m)} {stop(m)}|zoom off}\r\n");
+#endif
+#ifdef __TD_GATE__
+  chprintf(chp, "       transform {gate {start(ns)} {stop(ns)} [rect|normal|wide]|gate off}\r\n");
+#endif
 }
 
 static void cmd_test(BaseSequentialStream *chp, int argc, char *argv[])
@@ -2007,8 +2819,32 @@ static void cmd_gain(BaseSequentialStream *chp, int argc, char *argv[])
 {
   int rvalue;
   int lvalue = 0;
+#ifdef __GAIN_AUTO__
+  if (argc == 2 && strcmp(argv[0], "auto") == 0) {
+    chMtxLock(&mutex_sweep);
+    if (strcmp(argv[1], "on") == 0) {
+      gain_auto = true;
+    } else if (strcmp(argv[1], "off") == 0) {
+      const harmonic_t *row = get_harmonic(frequency);
+      gain_auto = false;
+      tlv320aic3204_set_gain(row->lgain, row->rgain);
+    } else if (strcmp(argv[1], "cal") == 0) {
+      if (gain_calibrate())
+        chprintf(chp, "gain step: %f dB\r\n", gain_unit_db);
+      else
+        chprintf(chp, "gain cal failed, connect thru\r\n");
+    } else {
+      chprintf(chp, "usage: gain auto {on|off|cal}\r\n");
+    }
+    chMtxUnlock(&mutex_sweep);
+    return;
+  }
+#endif
   if (argc != 1 && argc != 2) {
     chprintf(chp, "usage: gain {lgain(0-95)} [rgain(0-95)]\r\n");
+#ifdef __GAIN_AUTO__
+    chprintf(chp, "       gain auto {on|off|cal}\r\n");
+#endif
     return;
   }
   rvalue = atoi(argv[0]);
@@ -2017,6 +2853,68 @@ static void cmd_gain(BaseSequentialStream *chp, int argc, char *argv[])
   tlv320aic3204_set_gain(lvalue, rvalue);
 }
 
+#ifdef __CODEC_PROFILE__
+/*
+ * rate bench sweeps once per profile and reports the sweep speed and the
+ * mean transmission power, the noise floor with nothing on port 2.
+ */
+static void cmd_rate(BaseSequentialStream *chp, int argc, char *argv[])
+{
+  int p;
+  if (argc == 0) {
+    chprintf(chp, "%dkHz\r\n", 48 << codec_profile);
+    return;
+  }
+  if (argc == 1 && strcmp(argv[0], "bench") == 0) {
+    chMtxLock(&mutex_sweep);
+    int saved = codec_profile;
+    // raw frequency domain data: no calibration, edelay or gate
+    uint8_t saved_domain = domain_mode;
+    uint16_t saved_cal = cal_status;
+    float saved_edelay = electrical_delay;
+    domain_mode = (domain_mode & ~DOMAIN_MODE) | DOMAIN_FREQ;
+    cal_status &= ~CALSTAT_APPLY;
+    electrical_delay = 0;
+#ifdef __TD_GATE__
+    float saved_gate_start = td_gate_start, saved_gate_stop = td_gate_stop;
+    td_gate_stop = td_gate_start;
+#endif
+    for (p = 0; p < CODEC_PROFILES && sweep_points > 0; p++) {
+      set_codec_profile(p);
+      // warm-up, the first sweep at a new rate starts from another state
+      sweep(false);
+      systime_t start = chVTGetSystemTimeX();
+      sweep(false);
+      uint32_t ms = TIME_I2MS(chVTGetSystemTimeX() - start);
+      float power = 0;
+      for (int i = 0; i < sweep_points; i++)
+        power += measured[1][i][0] * measured[1][i][0] + measured[1][i][1] * measured[1][i][1];
+      chprintf(chp, "%dkHz: %d points/s, noise floor %f dB\r\n", 48 << p,
+               ms ? sweep_points * 1000 / ms : 0, 10 * log10f(power / sweep_points + 1e-20));
+    }
+    set_codec_profile(saved);
+    domain_mode = saved_domain;
+    cal_status = saved_cal;
+    electrical_delay = saved_edelay;
+#ifdef __TD_GATE__
+    td_gate_start = saved_gate_start;
+    td_gate_stop = saved_gate_stop;
+#endif
+    chMtxUnlock(&mutex_sweep);
+    return;
+  }
+  for (p = 0; argc == 1 && p < CODEC_PROFILES; p++) {
+    if (atoi(argv[0]) == 48 << p) {
+      chMtxLock(&mutex_sweep);
+      set_codec_profile(p);
+      chMtxUnlock(&mutex_sweep);
+      return;
+    }
+  }
+  chprintf(chp, "usage: rate [48|96|192|bench]\r\n");
+}
+#endif
+
 static void cmd_port(BaseSequentialStream *chp, int argc, char *argv[])
 {
   int port;
@@ -2062,6 +2960,15 @@ static void cmd_stat(BaseSequentialStream *chp, int argc, char *argv[])
   //chprintf(chp, "load: %d\r\n", stat.busy_cycles * 100 / stat.interval_cycles);
   extern int awd_count;
   chprintf(chp, "awd: %d\r\n", awd_count);
+  uint8_t addr;
+  int khz;
+  for (i = 0; (khz = i2c_get_speed(i, &addr)) != 0; i++)
+    chprintf(chp, "i2c 0x%02x: %dkHz\r\n", addr, khz);
+  chprintf(chp, "i2c errors: %d\r\n", i2c_errors);
+  chprintf(chp, "i2c bytes/point: %d\r\n", sweep_i2c_bytes);
+#ifdef __GAIN_AUTO__
+  chprintf(chp, "gain auto: %s, steps/sweep: %d\r\n", gain_auto ? "on" : "off", sweep_gain_steps);
+#endif
 }
 
 
@@ -2171,6 +3078,9 @@ static const ShellCommand commands[] =
     { "port", cmd_port },
     { "stat", cmd_stat },
     { "gain", cmd_gain },
+#ifdef __CODEC_PROFILE__
+    { "rate", cmd_rate },
+#endif
     { "power", cmd_power },
     { "sample", cmd_sample },
     //{ "gamma", cmd_gamma },
@@ -2213,19 +3123,6 @@ static const ShellConfig shell_cfgSerial =
     .sc_commands = commands
 };
 
-static const I2CConfig i2ccfg = {
-#ifdef NANOVNA_F303
-	.timingr  = STM32_TIMINGR_PRESC(8U)  |            /* 72MHz/9 = 8MHz I2CCLK.           */
-  STM32_TIMINGR_SCLDEL(3U) | STM32_TIMINGR_SDADEL(3U) |
-  STM32_TIMINGR_SCLH(3U)   | STM32_TIMINGR_SCLL(9U),
-#else
-  .timingr  = 0x00300506, //voodoo magic 400kHz @ HSI 8MHz
-#endif
-
-  .cr1      = 0,
-  .cr2      = 0
-};
-
 static DACConfig dac1cfg1 = {
   //.init =         2047U,
   .init =         1922U,
@@ -2259,7 +3156,7 @@ int main(void)
     /*
      * I2C & SI5351 Initialize
      */
-    i2cStart(&I2CD1, &i2ccfg);
+    i2c_start();
     while (!si5351_init()) {
         ili9341_drawstring_size("error: si5351_init failed", 0, 0, RGBHEX(0xff0000), 0x0000, 2);
     }
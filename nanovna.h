@@ -45,6 +45,14 @@ uint16_t adc_single_read(ADC_TypeDef *adc, uint32_t chsel);
 void adc_start_analog_watchdogd(ADC_TypeDef *adc, uint32_t chsel);
 #define POINT_COUNT     101
 #define SPI_BUFFER_SIZE 2048
+#define __TD_ZOOM__     // chirp-z zoomed time domain
+#define __TD_GATE__     // time domain gating
+#define __GRID_MASK__   // precomputed smith/polar grid bitmap
+#define __POLAR_BUCKET__ // smith/polar trace segments bucketed per cell
+#define __SI5351_PLAN__ // synthesizer registers precomputed per sweep point
+#define __I2C_ASYNC__   // queued i2c writes sent by a separate thread
+#define __GAIN_AUTO__   // receiver gain ranging per sweep point
+#define __CODEC_PROFILE__ // 48/96/192kHz codec sample rate profiles
 #else
 #define STM32F072xB_SYSTEM_MEMORY 0x1FFFC800
 #define BOOT_FROM_SYTEM_MEMORY_MAGIC_ADDRESS 0x20003FF0
@@ -52,6 +60,7 @@ void adc_start_analog_watchdogd(ADC_TypeDef *adc, uint32_t chsel);
 #define SYSTEM_BOOT_MSP 0x20002250
 #define POINT_COUNT     101
 #define SPI_BUFFER_SIZE 1024
+#define __USE_FFT_Q15__ // no FPU, use fixed point FFT (see test/fft_test.c)
 #endif
 
 #if defined(ILI9488) || defined(ILI9486) || defined(ST7796S)
@@ -72,11 +81,19 @@ void ili9341_test(int);
 #define YSTEP 7
 //#define SPI_BUFFER_SIZE 1024
 #endif
+
+#if defined(NANOVNA_F303) && !defined(ILI9488)
+#define __LCD_ASYNC__   // spi_buffer holds two cells, send one while drawing other
+#endif
 #define MARKER_COUNT    4
 #define TRACE_COUNT     4
 
 
 extern float measured[2][POINT_COUNT][2];
+#ifdef __SI5351_PLAN__
+// delivered - requested frequency (Hz) of RF [0] and LO [1] per point
+extern float frequency_error[POINT_COUNT][2];
+#endif
 
 #define CAL_LOAD 0
 #define CAL_OPEN 1
@@ -110,10 +127,22 @@ extern float measured[2][POINT_COUNT][2];
 #define TD_FUNC_BANDPASS        (0<<1)
 #define TD_FUNC_LOWPASS_IMPULSE (1<<1)
 #define TD_FUNC_LOWPASS_STEP    (2<<1)
-#define TD_WINDOW               (3<<3)
+#define TD_WINDOW               (7<<3)
 #define TD_WINDOW_NORMAL        (0<<3)
 #define TD_WINDOW_MINIMUM       (1<<3)
 #define TD_WINDOW_MAXIMUM       (2<<3)
+#define TD_WINDOW_HANN          (3<<3)
+#define TD_WINDOW_BLACKMAN_HARRIS (4<<3)
+#define TD_WINDOW_KAISER        (5<<3) // kaiser with user beta
+
+#define SPEED_OF_LIGHT 299792458
+
+#ifdef __TD_ZOOM__
+// time window of zoomed time domain (seconds), zoom is off when stop <= start
+extern float td_zoom_start;
+extern float td_zoom_stop;
+#define TD_ZOOM_ENABLED() (td_zoom_stop > td_zoom_start && (domain_mode & TD_FUNC) != TD_FUNC_LOWPASS_STEP)
+#endif
 
 #define FFT_SIZE 256
 
@@ -143,8 +172,22 @@ enum {
 };
 
 void set_sweep_frequency(int type, int32_t frequency);
+void update_frequencies(void);
 uint32_t get_sweep_frequency(int type);
 
+/*
+ * Harmonic mode of a frequency: row n of the table covers
+ * (n, n+1] times config.harmonic_freq_threshold, the last row the rest.
+ */
+typedef struct {
+  uint8_t rf_harmonic;  // RF is this harmonic of CLK1
+  uint8_t lo_harmonic;  // LO is this harmonic of CLK0
+  int8_t  lgain, rgain; // codec MICPGA gain
+  uint8_t settle;       // blocks to wait after a gain change
+} harmonic_t;
+
+const harmonic_t *get_harmonic(uint32_t freq);
+
 void toggle_sweep(void);
 
 extern int8_t sweep_enabled;
@@ -177,8 +220,25 @@ void reset_dsp_accumerator(void);
 void calculate_gamma(float *gamma);
 void fetch_amplitude(float *gamma);
 void fetch_amplitude_ref(float *gamma);
+#ifdef __GAIN_AUTO__
+int sample_peak(void);
+float sample_level(void);
+#endif
 
 
+/*
+ * i2c.c
+ */
+
+void i2c_start(void);
+bool i2c_write(uint8_t addr, const uint8_t *buf, int len);
+bool i2c_read(uint8_t addr, const uint8_t *tx, int txlen, uint8_t *rx, int rxlen);
+void i2c_flush(void);
+void i2c_tune(uint8_t addr, uint8_t reg, const uint8_t *data, int len, uint16_t max_khz);
+int i2c_get_speed(int i, uint8_t *addr);
+extern volatile uint16_t i2c_errors;
+extern volatile uint32_t i2c_bytes;
+
 /*
  * tlv320aic3204.c
  */
@@ -186,6 +246,10 @@ void fetch_amplitude_ref(float *gamma);
 extern void tlv320aic3204_init(void);
 extern void tlv320aic3204_set_gain(int lgain, int rgain);
 extern void tlv320aic3204_select(int channel);
+#ifdef __CODEC_PROFILE__
+#define CODEC_PROFILES 3
+extern void tlv320aic3204_set_rate(int profile);
+#endif
 
 
 /*
@@ -351,6 +415,11 @@ extern mutex_t mutex_ili9341;
 void ili9341_init(void);
 void ili9341_test(int mode);
 void ili9341_bulk(int x, int y, int w, int h);
+#ifdef __LCD_ASYNC__
+void ili9341_bulk_async(int x, int y, int w, int h, const uint16_t *buf);
+void ili9341_bulk_wait(void);
+void ili9341_fill_async(int x, int y, int w, int h, int color);
+#endif
 void ili9341_fill(int x, int y, int w, int h, int color);
 #if !defined(ST7796S)
 void ili9341_drawchar_5x7(uint8_t ch, int x, int y, uint16_t fg, uint16_t bg);
@@ -387,8 +456,9 @@ typedef struct {
   trace_t _trace[TRACE_COUNT];
   marker_t _markers[MARKER_COUNT];
   int _active_marker;
-  uint8_t _domain_mode; /* 0bxxxxxffm : where ff: TD_FUNC m: DOMAIN_MODE */
+  uint8_t _domain_mode; /* 0bxxwwwffm : where www: TD_WINDOW ff: TD_FUNC m: DOMAIN_MODE */
   uint8_t _velocity_factor; // %
+  uint8_t _kaiser_beta; // TD_WINDOW_KAISER beta * 10
 
   int32_t checksum;
 } properties_t;
@@ -414,9 +484,11 @@ extern int8_t previous_marker;
 #define active_marker current_props._active_marker
 #define domain_mode current_props._domain_mode
 #define velocity_factor current_props._velocity_factor
+#define kaiser_beta current_props._kaiser_beta
 
 int caldata_save(int id);
 int caldata_recall(int id);
+extern uint8_t cal_segments;
 const properties_t *caldata_ref(int id);
 
 int config_save(void);
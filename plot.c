@@ -14,6 +14,7 @@
 static void cell_draw_marker_info(int m, int n, int w, int h);
 static void frequency_string(char *buf, size_t len, int32_t freq);
 static void markmap_all_markers(void);
+static void update_rectangular_grid(void);
 
 //#define GRID_COLOR 0x0863
 //uint16_t grid_color = 0x1084;
@@ -38,6 +39,17 @@ int area_height = HEIGHT;
 #define CELLWIDTH 32
 #define CELLHEIGHT 32
 
+#ifdef __LCD_ASYNC__
+// two cell buffers in spi_buffer, next cell is drawn while previous is sent
+#define CELL_BUFFER_SIZE (CELLWIDTH*CELLHEIGHT)
+#if SPI_BUFFER_SIZE < 2*CELL_BUFFER_SIZE
+#error "spi_buffer too small for two cells"
+#endif
+static uint16_t *cell_buffer = spi_buffer;
+#else
+#define cell_buffer spi_buffer
+#endif
+
 /*
  * CELL_X0[27:31] cell position
  * CELL_Y0[22:26]
@@ -91,6 +103,7 @@ void update_grid(void)
   grid_offset = (WIDTH-1) * ((fstart % fgrid) / 100) / (fspan / 100);
   grid_width = (WIDTH-1) * (fgrid / 100) / (fspan / 1000);
 
+  update_rectangular_grid();
   force_set_markmap();
   redraw_request |= REDRAW_FREQUENCY;
 }
@@ -110,9 +123,10 @@ static int circle_inout(int x, int y, int r)
 #define P_CENTER_Y (HEIGHT/2)
 #define P_RADIUS (HEIGHT/2)
 
+// grid tests return non-zero on a grid pixel, whatever config.grid_color is
 static int polar_grid(int x, int y)
 {
-  int c = config.grid_color;
+  int c = 1;
   int d;
 
   // offset to center
@@ -155,7 +169,7 @@ static int polar_grid(int x, int y)
  */
 static int smith_grid(int x, int y)
 {
-  int c = config.grid_color;
+  int c = 1;
   int d;
 
   // offset to center
@@ -310,7 +324,7 @@ const int cirs[][4] = {
 
 static int smith_grid3(int x, int y)
 {
-  int c = config.grid_color;
+  int c = 1;
   int d;
 
   // offset to center
@@ -343,6 +357,44 @@ static int smith_grid3(int x, int y)
   return 0;
 }
 
+#ifdef __GRID_MASK__
+/*
+ * Smith/polar grid rasterized into a 1-bit mask, so draw_cell does not
+ * evaluate the circles for every pixel. Both grids are symmetric about the
+ * horizontal axis, only rows 0..P_RADIUS from the center are stored.
+ * Only read by CPU, so it lives in CCM.
+ */
+#define GRID_MASK_COLS  (P_RADIUS*2+1)
+#define GRID_MASK_WORDS ((GRID_MASK_COLS+31)/32)
+static uint32_t grid_mask[P_RADIUS+1][GRID_MASK_WORDS] __attribute__((section(".ram4")));
+static uint16_t grid_mask_mode = 0;
+
+static void update_grid_mask(uint16_t mode)
+{
+  int x, y;
+  if (grid_mask_mode == mode)
+    return;
+  for (y = 0; y <= P_RADIUS; y++) {
+    uint32_t *row = grid_mask[y];
+    memset(row, 0, sizeof grid_mask[0]);
+    for (x = 0; x < GRID_MASK_COLS; x++) {
+      int px = x - P_RADIUS + P_CENTER_X;
+      int py = y + P_CENTER_Y;
+      int c;
+      if (mode == GRID_SMITH)
+        c = smith_grid(px, py);
+      else if (mode == GRID_ADMIT)
+        c = smith_grid3(px, py);
+      else
+        c = polar_grid(px, py);
+      if (c)
+        row[x>>5] |= 1U<<(x&31);
+    }
+  }
+  grid_mask_mode = mode;
+}
+#endif
+
 #if 0
 int
 rectangular_grid(int x, int y)
@@ -366,19 +418,20 @@ rectangular_grid(int x, int y)
 
 static int rectangular_grid_x(int x)
 {
-  int c = config.grid_color;
+  int c = 1;
   if (x < 0)
     return 0;
   if (x == 0 || x == WIDTH)
     return c;
-  if ((((x + grid_offset) * 10) % grid_width) < 10)
+  // no frequency lines while grid_width is unset (zero span)
+  if (grid_width > 0 && (((x + grid_offset) * 10) % grid_width) < 10)
     return c;
   return 0;
 }
 
 static int rectangular_grid_y(int y)
 {
-  int c = config.grid_color;
+  int c = 1;
   if (y < 0)
     return 0;
   if ((y % GRIDY) == 0)
@@ -386,6 +439,29 @@ static int rectangular_grid_y(int y)
   return 0;
 }
 
+/*
+ * Rectangular grid pattern as bitsets, column bit x+CELLOFFSETX and row bit y.
+ * Rebuilt by update_grid when grid_offset/grid_width change.
+ */
+static uint32_t grid_column_bits[(AREA_WIDTH_NORMAL+CELLOFFSETX+31)/32];
+static uint32_t grid_row_bits[(HEIGHT+31)/32];
+
+#define GRID_COLUMN(x) (grid_column_bits[((x)+CELLOFFSETX)>>5] & (1U<<(((x)+CELLOFFSETX)&31)))
+#define GRID_ROW(y)    (grid_row_bits[(y)>>5] & (1U<<((y)&31)))
+
+static void update_rectangular_grid(void)
+{
+  int i;
+  memset(grid_column_bits, 0, sizeof grid_column_bits);
+  memset(grid_row_bits, 0, sizeof grid_row_bits);
+  for (i = 0; i < AREA_WIDTH_NORMAL+CELLOFFSETX; i++)
+    if (rectangular_grid_x(i - CELLOFFSETX))
+      grid_column_bits[i>>5] |= 1U<<(i&31);
+  for (i = 0; i < HEIGHT; i++)
+    if (rectangular_grid_y(i))
+      grid_row_bits[i>>5] |= 1U<<(i&31);
+}
+
 #if 0
 int
 set_strut_grid(int x)
@@ -425,7 +501,7 @@ draw_on_strut(int v0, int d, int color)
 /*
  * calculate log10(abs(gamma))
  */ 
-static float logmag(float *v)
+static float logmag(const float *v)
 {
   return log10f(v[0]*v[0] + v[1]*v[1]) * 10;
 }
@@ -433,7 +509,7 @@ static float logmag(float *v)
 /*
  * calculate phase[-2:2] of coefficient
  */ 
-static float phase(float *v)
+static float phase(const float *v)
 {
   return 2 * atan2f(v[1], v[0]) / M_PI * 90;
 }
@@ -445,16 +521,14 @@ static float group_delay(float gamma[POINT_COUNT][2], uint32_t* freq, int count,
 {
     float *v, *w;
     float deltaf;
-    if (index == count-1) {
-        deltaf = freq[index] - freq[index-1];
-        v = gamma[index-1];
-        w = gamma[index];
-    }
-    else {
-        deltaf = freq[index+1] - freq[index];
-        v = gamma[index];
-        w = gamma[index+1];
-    }
+    if (index == count-1)
+        index--;
+    deltaf = freq[index+1] - freq[index];
+#ifdef __SI5351_PLAN__
+    deltaf += frequency_error[index+1][0] - frequency_error[index][0];
+#endif
+    v = gamma[index];
+    w = gamma[index+1];
     // w = w[0]/w[1]
     // v = v[0]/v[1]
     // atan(w)-atan(v) = atan((w-v)/(1+wv))
@@ -466,7 +540,7 @@ static float group_delay(float gamma[POINT_COUNT][2], uint32_t* freq, int count,
 /*
  * calculate abs(gamma)
  */
-static float linear(float *v)
+static float linear(const float *v)
 {
   return  sqrtf(v[0]*v[0] + v[1]*v[1]);
 }
@@ -761,12 +835,15 @@ void trace_get_info(int t, char *buf, int len)
 }
 
 static float time_of_index(int idx) {
+#ifdef __TD_ZOOM__
+   if (TD_ZOOM_ENABLED())
+     return td_zoom_start + (td_zoom_stop - td_zoom_start) * idx / (sweep_points - 1);
+#endif
    return 1.0 / (float)(frequencies[1] - frequencies[0]) / (float)FFT_SIZE * idx;
 }
 
 static float distance_of_index(int idx) {
-#define SPEED_OF_LIGHT 299792458
-   float distance = ((float)idx * (float)SPEED_OF_LIGHT) / ( (float)(frequencies[1] - frequencies[0]) * (float)FFT_SIZE * 2.0);
+   float distance = time_of_index(idx) * (float)SPEED_OF_LIGHT / 2.0;
    return distance * (velocity_factor / 100.0);
 }
 
@@ -848,6 +925,68 @@ static void mark_cells_from_index(void)
   }
 }
 
+#ifdef __POLAR_BUCKET__
+/*
+ * Smith/polar segments bucketed by cell (CSR layout), so draw_cell only
+ * draws segments whose bounding box touches the cell.
+ * Entry is t*POINT_COUNT+i for segment i-1 -> i of trace t.
+ */
+#define CELL_COLS ((AREA_WIDTH_NORMAL+CELLWIDTH-1)/CELLWIDTH)
+#define CELL_ROWS ((HEIGHT+CELLHEIGHT-1)/CELLHEIGHT)
+#define POLAR_BUCKET_SIZE (POINT_COUNT*TRACE_COUNT*3)
+static uint16_t polar_bucket_offset[CELL_COLS*CELL_ROWS+1];
+static uint16_t polar_bucket[POLAR_BUCKET_SIZE];
+// traces present in bucket, 0 on overflow (draw all segments)
+static uint8_t polar_bucket_traces = 0;
+
+static void update_polar_bucket(void)
+{
+  int t, i, m, n, pass;
+  uint8_t traces = 0;
+  polar_bucket_traces = 0;
+  memset(polar_bucket_offset, 0, sizeof polar_bucket_offset);
+  for (t = 0; t < TRACE_COUNT; t++)
+    if (trace[t].enabled && (trace[t].type == TRC_SMITH || trace[t].type == TRC_POLAR))
+      traces |= 1<<t;
+  if (traces == 0)
+    return;
+  // pass 0 counts entries per cell, pass 1 fills buckets from the end
+  for (pass = 0; pass < 2; pass++) {
+    for (t = TRACE_COUNT-1; t >= 0; t--) {
+      if (!(traces & (1<<t)))
+        continue;
+      for (i = sweep_points-1; i > 0; i--) {
+        int x1 = CELL_X(trace_index[t][i-1]);
+        int x2 = CELL_X(trace_index[t][i]);
+        int y1 = CELL_Y(trace_index[t][i-1]);
+        int y2 = CELL_Y(trace_index[t][i]);
+        if (x1 > x2) SWAP(x1, x2);
+        if (y1 > y2) SWAP(y1, y2);
+        int m1 = x2 / CELLWIDTH;
+        int n1 = y2 / CELLHEIGHT;
+        if (m1 >= CELL_COLS) m1 = CELL_COLS-1;
+        if (n1 >= CELL_ROWS) n1 = CELL_ROWS-1;
+        for (n = y1 / CELLHEIGHT; n <= n1; n++)
+          for (m = x1 / CELLWIDTH; m <= m1; m++) {
+            if (pass == 0)
+              polar_bucket_offset[n*CELL_COLS+m]++;
+            else
+              polar_bucket[--polar_bucket_offset[n*CELL_COLS+m]] = t*POINT_COUNT+i;
+          }
+      }
+    }
+    if (pass == 0) {
+      // prefix sum to end positions
+      for (i = 1; i <= CELL_COLS*CELL_ROWS; i++)
+        polar_bucket_offset[i] += polar_bucket_offset[i-1];
+      if (polar_bucket_offset[CELL_COLS*CELL_ROWS] > POLAR_BUCKET_SIZE)
+        return;
+    }
+  }
+  polar_bucket_traces = traces;
+}
+#endif
+
 void plot_into_index(float measured[2][POINT_COUNT][2])
 {
   int i, t;
@@ -859,7 +998,7 @@ void plot_into_index(float measured[2][POINT_COUNT][2])
       int n = trace[t].channel;
       trace_index[t][i] = trace_into_index(
         x, t, i,
-        measured[n], frequencies, sweep_points);
+        measured[n], (uint32_t *)frequencies, sweep_points);
     }
   }
 #if 0
@@ -868,6 +1007,9 @@ void plot_into_index(float measured[2][POINT_COUNT][2])
       quicksort(trace_index[t], 0, sweep_points);
 #endif
 
+#ifdef __POLAR_BUCKET__
+  update_polar_bucket();
+#endif
   mark_cells_from_index();
   markmap_all_markers();
 }
@@ -896,6 +1038,19 @@ static inline uint8_t _compute_outcode(int w, int h, int x, int y)
     return code;
 }
 
+/*
+ * Minor axis steps done by the Bresenham loop in cell_drawline after k
+ * major steps (d0 major, d1 minor delta), at most one per step.
+ */
+static inline int bresenham_steps(int d0, int d1, int k)
+{
+  if (k == 0)
+    return 0;
+  int s = 2*d1 - d0 + 2*d1*k;
+  int n = s >= 0 ? s / (2*d0) + 1 : 0;
+  return n < k ? n : k;
+}
+
 static void cell_drawline(int w, int h, int x0, int y0, int x1, int y1, int c)
 {
   uint8_t outcode0 = _compute_outcode(w, h, x0, y0);
@@ -914,37 +1069,85 @@ static void cell_drawline(int w, int h, int x0, int y0, int x1, int y1, int c)
   int dx = x1 - x0;
   int dy = y1 - y0;
   int sy = dy > 0 ? 1 : -1;
-  int e = 0;
+  int e, k, k1, n, i, last;
+  uint16_t *p;
 
   dy *= sy;
 
-  chMtxLock(&mutex_ili9341);
   if (dx >= dy) {
-      e = dy * 2 - dx;
-      while (x0 != x1) {
-          if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  spi_buffer[y0*w+x0] |= c;
-          x0++;
-          e += dy * 2;
-          if (e >= 0) {
-              e -= dx * 2;
-              y0 += sy;
+      // clip x range once, then draw horizontal runs
+      k = x0 < 0 ? -x0 : 0;
+      k1 = x1 < w ? dx : w - 1 - x0;
+      if (k > k1)
+        return;
+      n = bresenham_steps(dx, dy, k);
+      e = dy * 2 - dx + dy * 2 * k - dx * 2 * n;
+      x0 += k;
+      y0 += sy * n;
+      x1 = x0 + k1 - k;
+      while (1) {
+          int xs = x0;
+          last = 0;
+          while (1) {
+              if (x0 == x1) { last = 1; break; }
+              x0++;
+              e += dy * 2;
+              if (e >= 0) {
+                  e -= dx * 2;
+                  break;
+              }
+          }
+          if (y0 >= 0 && y0 < h) {
+              p = &cell_buffer[y0*w];
+              for (i = xs; i < x0 + last; i++)
+                  p[i] |= c;
           }
+          if (last)
+              break;
+          y0 += sy;
+          if (sy > 0 ? y0 >= h : y0 < 0)
+              break;
       }
-      if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  spi_buffer[y0*w+x0] |= c;
   } else {
-      e = dx * 2 - dy;
-      while (y0 != y1) {
-          if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  spi_buffer[y0*w+x0] |= c;
-          y0 += sy;
-          e += dx * 2;
-          if (e >= 0) {
-              e -= dy * 2;
-              x0++;
+      // clip y range once, then draw vertical runs
+      if (sy > 0) {
+        k = y0 < 0 ? -y0 : 0;
+        k1 = y1 < h ? dy : h - 1 - y0;
+      } else {
+        k = y0 >= h ? y0 - h + 1 : 0;
+        k1 = y1 >= 0 ? dy : y0;
+      }
+      if (k > k1)
+        return;
+      n = bresenham_steps(dy, dx, k);
+      e = dx * 2 - dy + dx * 2 * k - dy * 2 * n;
+      x0 += n;
+      y0 += sy * k;
+      y1 = y0 + sy * (k1 - k);
+      while (x0 < w) {
+          int ys = y0;
+          int len = 0;
+          last = 0;
+          while (1) {
+              len++;
+              if (y0 == y1) { last = 1; break; }
+              y0 += sy;
+              e += dx * 2;
+              if (e >= 0) {
+                  e -= dy * 2;
+                  break;
+              }
+          }
+          if (x0 >= 0) {
+              p = &cell_buffer[ys*w+x0];
+              for (; len > 0; len--, p += sy*w)
+                  *p |= c;
           }
+          if (last)
+              break;
+          x0++;
       }
-      if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  spi_buffer[y0*w+x0] |= c;
   }
-  chMtxUnlock(&mutex_ili9341);
 }
  #if 0
 int
@@ -1029,7 +1232,6 @@ static void draw_refpos(int w, int h, int x, int y, int c)
   int i, j;
   if (y < -3 || y > 32 + 3)
     return;
-  chMtxLock(&mutex_ili9341);
   for (j = 0; j < 3; j++) {
     int j0 = 6 - j*2;
     for (i = 0; i < j0; i++) {
@@ -1037,12 +1239,11 @@ static void draw_refpos(int w, int h, int x, int y, int c)
       int y0 = y - j;
       int y1 = y + j;
       if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)
-        spi_buffer[y0*w+x0] = c;
+        cell_buffer[y0*w+x0] = c;
       if (j != 0 && y1 >= 0 && y1 < h && x0 >= 0 && x0 < w)
-        spi_buffer[y1*w+x0] = c;
+        cell_buffer[y1*w+x0] = c;
     }
   }
-  chMtxUnlock(&mutex_ili9341);
 }
 
 
@@ -1066,7 +1267,6 @@ static void cell_draw_refpos(int m, int n, int w, int h)
 static void draw_marker(int w, int h, int x, int y, int c, int ch)
 {
   int i, j;
-  chMtxLock(&mutex_ili9341);
   for (j = FONT_HEIGHT+3; j >= 0; j--) {
     int j0 = j / 2;
     for (i = -j0; i <= j0; i++) {
@@ -1086,10 +1286,9 @@ static void draw_marker(int w, int h, int x, int y, int c, int ch)
       }
 
       if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)
-        spi_buffer[y0*w+x0] = cc;
+        cell_buffer[y0*w+x0] = cc;
     }
   }
-  chMtxUnlock(&mutex_ili9341);
 }
 
 void marker_position(int m, int t, int *x, int *y)
@@ -1308,21 +1507,49 @@ static void draw_cell(int m, int n)
   PULSE;
   /* draw grid */
   if (grid_mode & GRID_RECTANGULAR) {
-    for (x = 0; x < w; x++) {
-      uint16_t c = rectangular_grid_x(x+x0off);
-      for (y = 0; y < h; y++)
-        spi_buffer[y * w + x] = c;
-    }
+    uint16_t c = config.grid_color;
+    // vertical lines on first line, copy it down
+    for (x = 0; x < w; x++)
+      cell_buffer[x] = GRID_COLUMN(x+x0off) ? c : 0;
+    for (y = 1; y < h; y++)
+      memcpy(&cell_buffer[y * w], cell_buffer, w * sizeof cell_buffer[0]);
+    // horizontal lines span x in [0, WIDTH]
+    int xs = -x0off;
+    int xe = WIDTH + 1 - x0off;
+    if (xs < 0) xs = 0;
+    if (xe > w) xe = w;
     for (y = 0; y < h; y++) {
-      uint16_t c = rectangular_grid_y(y+y0);
-      for (x = 0; x < w; x++)
-        if (x+x0off >= 0 && x+x0off <= WIDTH)
-          spi_buffer[y * w + x] |= c;
+      if (!GRID_ROW(y+y0))
+        continue;
+      uint16_t *p = &cell_buffer[y * w];
+      for (x = xs; x < xe; x++)
+        p[x] = c;
     }
   } else {
-    memset(spi_buffer, 0, sizeof spi_buffer);
+    memset(cell_buffer, 0, w * h * sizeof cell_buffer[0]);
   }
   if (grid_mode & (GRID_SMITH|GRID_ADMIT|GRID_POLAR)) {
+#ifdef __GRID_MASK__
+    uint16_t c = config.grid_color;
+    int xs = P_CENTER_X - P_RADIUS - x0off;
+    int xe = P_CENTER_X + P_RADIUS + 1 - x0off;
+    if (xs < 0) xs = 0;
+    if (xe > w) xe = w;
+    update_grid_mask(grid_mode & GRID_SMITH ? GRID_SMITH :
+                     grid_mode & GRID_ADMIT ? GRID_ADMIT : GRID_POLAR);
+    for (y = 0; y < h; y++) {
+      int dy = y + y0 - P_CENTER_Y;
+      if (dy < 0) dy = -dy;
+      if (dy > P_RADIUS)
+        continue;
+      const uint32_t *row = grid_mask[dy];
+      for (x = xs; x < xe; x++) {
+        int b = x + x0off - P_CENTER_X + P_RADIUS;
+        if (row[b>>5] & (1U<<(b&31)))
+          cell_buffer[y * w + x] |= c;
+      }
+    }
+#else
     for (y = 0; y < h; y++) {
       for (x = 0; x < w; x++) {
         uint16_t c = 0;
@@ -1333,9 +1560,11 @@ static void draw_cell(int m, int n)
         //c = smith_grid2(x+x0, y+y0, 0.5);
         else if (grid_mode & GRID_POLAR)
           c = polar_grid(x+x0off, y+y0);
-        spi_buffer[y * w + x] |= c;
+        if (c)
+          cell_buffer[y * w + x] |= config.grid_color;
       }
     }
+#endif
   }
   PULSE;
 
@@ -1365,12 +1594,35 @@ static void draw_cell(int m, int n)
 #endif
 #if 1
   /* draw polar plot */
+#ifdef __POLAR_BUCKET__
+  if (polar_bucket_traces) {
+    int j = n*CELL_COLS + m;
+    int j1 = polar_bucket_offset[j+1];
+    for (j = polar_bucket_offset[j]; j < j1; j++) {
+      t = polar_bucket[j] / POINT_COUNT;
+      i = polar_bucket[j] % POINT_COUNT;
+      if (!trace[t].enabled)
+        continue;
+      if (trace[t].type != TRC_SMITH && trace[t].type != TRC_POLAR)
+        continue;
+      int x1 = CELL_X(trace_index[t][i-1]);
+      int x2 = CELL_X(trace_index[t][i]);
+      int y1 = CELL_Y(trace_index[t][i-1]);
+      int y2 = CELL_Y(trace_index[t][i]);
+      cell_drawline(w, h, x1 - x0, y1 - y0, x2 - x0, y2 - y0, config.trace_color[t]);
+    }
+  }
+#endif
   for (t = 0; t < TRACE_COUNT; t++) {
     int c = config.trace_color[t];
     if (!trace[t].enabled)
       continue;
     if (trace[t].type != TRC_SMITH && trace[t].type != TRC_POLAR)
       continue;
+#ifdef __POLAR_BUCKET__
+    if (polar_bucket_traces & (1<<t))
+      continue;
+#endif
 
     for (i = 1; i < sweep_points; i++) {
       //uint32_t index = trace_index[t][i];
@@ -1396,18 +1648,32 @@ static void draw_cell(int m, int n)
   if (m == 0)
     cell_draw_refpos(m, n, w, h);
 
+#ifdef __LCD_ASYNC__
+  ili9341_bulk_async(OFFSETX + x0off, OFFSETY + y0, w, h, cell_buffer);
+  // switch to other buffer for next cell
+  cell_buffer = (cell_buffer == spi_buffer) ? &spi_buffer[CELL_BUFFER_SIZE] : spi_buffer;
+#else
   ili9341_bulk(OFFSETX + x0off, OFFSETY + y0, w, h);
+#endif
   chMtxUnlock(&mutex_ili9341); // [/protect spi_buffer]
 }
 
 static void draw_all_cells(bool flush_markmap)
 {
   int m, n;
+#ifdef __LCD_ASYNC__
+  // keep lock while cell transfers are in flight
+  chMtxLock(&mutex_ili9341);
+#endif
   for (m = 0; m < (area_width+CELLWIDTH-1) / CELLWIDTH; m++)
     for (n = 0; n < (area_height+CELLHEIGHT-1) / CELLHEIGHT; n++) {
       if (is_mapmarked(m, n))
         draw_cell(m, n);
     }
+#ifdef __LCD_ASYNC__
+  ili9341_bulk_wait();
+  chMtxUnlock(&mutex_ili9341);
+#endif
 
   if (flush_markmap) {
     // keep current map for update
@@ -1505,7 +1771,6 @@ static  void cell_drawchar_5x7(int w, int h, uint8_t ch, int x, int y, uint16_t
   int c, r;
   if (y <= -7 || y >= h || x <= -5 || x >= w)
     return;
-  chMtxLock(&mutex_ili9341);
   for(c = 0; c < 7; c++) {
     if ((y + c) < 0 || (y + c) >= h)
       continue;
@@ -1514,11 +1779,10 @@ static  void cell_drawchar_5x7(int w, int h, uint8_t ch, int x, int y, uint16_t
       bits = ~bits;
     for (r = 0; r < 5; r++) {
       if ((x+r) >= 0 && (x+r) < w && (0x80 & bits)) 
-        spi_buffer[(y+c)*w + (x+r)] = fg;
+        cell_buffer[(y+c)*w + (x+r)] = fg;
       bits <<= 1;
     }
   }
-  chMtxUnlock(&mutex_ili9341);
 }
 
 static void cell_drawstring_5x7(int w, int h, char *str, int x, int y, uint16_t fg)
@@ -1564,7 +1828,7 @@ static void cell_draw_marker_info(int m, int n, int w, int h)
     xpos += 64;
     trace_get_value_string(
         t, buf, sizeof buf,
-        idx, measured[trace[t].channel], frequencies, sweep_points);
+        idx, measured[trace[t].channel], (uint32_t *)frequencies, sweep_points);
     cell_drawstring_5x7(w, h, buf, xpos, ypos, config.trace_color[t]);
     j++;
   }    
@@ -1661,6 +1925,11 @@ void draw_frequencies(void)
         ili9341_drawstring_5x7(buf, 195, HEIGHT, 0xffff, 0x0000);
       }
   } else {
+#ifdef __TD_ZOOM__
+      if (TD_ZOOM_ENABLED())
+        chsnprintf(buf, BUF_LEN, "START %d ns        ", (int)(time_of_index(0) * 1e9));
+      else
+#endif
       strcpy(buf, "START 0s        ");
       ili9341_drawstring_5x7(buf, OFFSETX, HEIGHT, 0xffff, 0x0000);
 
@@ -1717,7 +1986,6 @@ static void cell_drawchar_7x13(int w, int h, uint8_t ch, int x, int y, uint16_t
   int c, r;
   if (y <= -13 || y >= h || x <= -7 || x >= w)
     return;
-  chMtxLock(&mutex_ili9341);
   for(c = 0; c < 13; c++) {
     if ((y + c) < 0 || (y + c) >= h)
       continue;
@@ -1726,11 +1994,10 @@ static void cell_drawchar_7x13(int w, int h, uint8_t ch, int x, int y, uint16_t
       bits = ~bits;
     for (r = 0; r < 7; r++) {
       if ((x+r) >= 0 && (x+r) < w && (0x8000 & bits)) 
-        spi_buffer[(y+c)*w + (x+r)] = fg;
+        cell_buffer[(y+c)*w + (x+r)] = fg;
       bits <<= 1;
     }
   }
-  chMtxUnlock(&mutex_ili9341);
 }
 
 static void cell_drawstring_7x13(int w, int h, char *str, int x, int y, uint16_t fg)
@@ -1777,7 +2044,7 @@ static void cell_draw_marker_info(int m, int n, int w, int h)
     xpos += 90;
     trace_get_value_string(
         t, buf, sizeof buf,
-        idx, measured[trace[t].channel], frequencies, sweep_points);
+        idx, measured[trace[t].channel], (uint32_t *)frequencies, sweep_points);
     cell_drawstring_7x13(w, h, buf, xpos, ypos, config.trace_color[t]);
     j++;
   }
@@ -1879,6 +2146,11 @@ void draw_frequencies(void)
         ili9341_drawstring_7x13(buf, 280, HEIGHT+1, 0xffff, 0x0000);
       }
   } else {
+#ifdef __TD_ZOOM__
+      if (TD_ZOOM_ENABLED())
+        chsnprintf(buf, BUF_LEN, "START %d ns        ", (int)(time_of_index(0) * 1e9));
+      else
+#endif
       strcpy(buf, "START 0s        ");
       ili9341_drawstring_7x13(buf, OFFSETX, HEIGHT+1, 0xffff, 0x0000);
 
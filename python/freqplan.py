@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+#
+# Offline si5351 frequency planner for NanoVNA sweeps.
+#
+# Models the register settings the firmware picks for every sweep point
+# (si5351_plan_frequency in si5351.c) and compares them with an optimized
+# plan that chooses PLL frequency and multisynth divider per point so that
+# PLL resets inside a sweep are avoided and even integer dividers are used
+# where the VCO range allows.  Nothing here talks to the device.
+#
+from math import gcd
+from optparse import OptionParser
+
+XTAL = 26000000
+PLL_N = 32
+PLLFREQ = XTAL * PLL_N
+DENOM_LIMIT = 1 << 20
+
+# datasheet range is 600-900MHz, the firmware already runs the PLL at
+# up to 4 * harmonic threshold
+VCO_MIN = 600000000
+VCO_MAX = 1200000000
+
+# sweep() waits clamp(delay, 3, 8) blocks of 1ms per channel
+DELAY_MIN = 3
+DELAY_MAX = 8
+RESET_DELAY = 10
+I2C_CLOCK = 400000
+
+# spur heuristic: a fractional ratio close to p/q (q <= SPUR_Q) beats
+# at (reference * distance); it matters if that falls inside the window
+SPUR_Q = 16
+
+
+def reduce(num, denom):
+    # same as si5351_set_frequency_fixedpll/fixeddiv
+    k = gcd(num, denom)
+    num //= k
+    denom //= k
+    while denom >= DENOM_LIMIT:
+        num >>= 1
+        denom >>= 1
+    return num, denom
+
+
+def spur_offset(ref, num, denom):
+    """lowest beat frequency of a fractional ratio num/denom, None if exact"""
+    if num == 0:
+        return None
+    frac = num / denom
+    best = None
+    for q in range(1, SPUR_Q + 1):
+        p = round(frac * q)
+        d = abs(frac - p / q)
+        if d == 0:
+            # exact small rational, spurs at ref/q
+            off = ref / q
+        else:
+            off = ref * d
+        if best is None or off < best[0]:
+            best = (off, q)
+    return best
+
+
+class Stage:
+    """one fractional divider: a + b/c, driven by ref"""
+    def __init__(self, kind, ref, a, b, c):
+        self.kind = kind
+        self.ref = ref
+        self.a = a
+        self.b = b
+        self.c = c
+
+    @property
+    def integer(self):
+        return self.b == 0
+
+    @property
+    def ratio(self):
+        return self.a + self.b / self.c
+
+    def regs(self):
+        # P1/P2/P3 as packed by si5351_pack_params
+        if self.b == 0:
+            return (128 * self.a - 512, 0, 1)
+        p1 = 128 * self.a + (128 * self.b) // self.c - 512
+        p2 = 128 * self.b - self.c * ((128 * self.b) // self.c)
+        return (p1, p2, self.c)
+
+    def spur(self):
+        if self.kind == 'pll':
+            return spur_offset(self.ref, self.b, self.c)
+        # multisynth beat is relative to its output
+        return spur_offset(self.ref / self.ratio, self.b, self.c)
+
+
+class Clock:
+    def __init__(self, target, pll, ms, rdiv):
+        self.target = target
+        self.pll = pll
+        self.ms = ms
+        self.rdiv = rdiv
+
+    @property
+    def vco(self):
+        return XTAL * self.pll.ratio
+
+    @property
+    def delivered(self):
+        return self.vco / self.ms.ratio / self.rdiv
+
+    def stages(self):
+        return (self.pll, self.ms)
+
+
+class Point:
+    """
+    state identifies what a change needs a PLL reset for: the shared PLL
+    frequency, or the integer divider of the per clock PLLs. R divider and
+    fractional multisynth changes are glitch free.
+    """
+    def __init__(self, state, rf, lo):
+        self.state = state
+        self.rf = rf  # CLK1
+        self.lo = lo  # CLK0
+
+    def clocks(self):
+        return (self.lo, self.rf)
+
+
+# RF/LO harmonic per multiple of the threshold, see harmonic_table in main.c
+HARMONICS = [(1, 1), (3, 5), (3, 5), (5, 7), (5, 7), (7, 9), (7, 9)]
+
+
+def harmonic(freq, offset, threshold):
+    """fundamentals of CLK1 and CLK0 as chosen by the firmware"""
+    row = min((freq - 1) // threshold if freq else 0, len(HARMONICS) - 1)
+    rf, lo = HARMONICS[row]
+    return freq // rf, (freq + offset) // lo
+
+
+def fixed_pll(target, pllfreq, mult, rdiv):
+    freq = target * rdiv
+    div = pllfreq // freq
+    num, denom = reduce(pllfreq - freq * div, freq)
+    pll = Stage('pll', XTAL, mult, 0, 1)
+    return Clock(target, pll, Stage('ms', pllfreq, div, num, denom), rdiv)
+
+
+def fixed_div(target, div, rdiv):
+    pllfreq = target * rdiv * div
+    multi = pllfreq // XTAL
+    num, denom = reduce(pllfreq - multi * XTAL, XTAL)
+    pll = Stage('pll', XTAL, multi, num, denom)
+    return Clock(target, pll, Stage('ms', XTAL * pll.ratio, div, 0, 1), rdiv)
+
+
+def current_point(freq, offset, threshold):
+    """the firmware band split, see si5351_plan_frequency"""
+    f, of = harmonic(freq, offset, threshold)
+    if f <= 100000000:
+        band = 0
+    elif f < 160000000:
+        band = 1
+    else:
+        band = 2
+    rdiv = 1
+    if f <= 500000:
+        rdiv = 64
+    elif f <= 4000000:
+        rdiv = 8
+    if band == 0:
+        return Point(('pll', PLL_N), fixed_pll(f, PLLFREQ, PLL_N, rdiv),
+                     fixed_pll(of, PLLFREQ, PLL_N, rdiv))
+    div = 6 if band == 1 else 4
+    return Point(('div', div), fixed_div(f, div, 1), fixed_div(of, div, 1))
+
+
+def candidates(freq, offset, threshold, vco_min, vco_max):
+    """every setting the optimizer may use for one point"""
+    f, of = harmonic(freq, offset, threshold)
+    lo, hi = min(f, of), max(f, of)
+    points = []
+    # shared integer PLL, fractional (or lucky integer) multisynth
+    for mult in range(vco_min // XTAL + 1, vco_max // XTAL + 1):
+        vco = XTAL * mult
+        rdiv = 1
+        while rdiv < 128 and vco // (lo * rdiv) > 2048:
+            rdiv *= 2
+        if vco // (hi * rdiv) < 8 or vco // (lo * rdiv) > 2048:
+            continue
+        points.append(Point(('pll', mult), fixed_pll(f, vco, mult, rdiv),
+                            fixed_pll(of, vco, mult, rdiv)))
+    # one PLL per clock, even integer multisynth
+    seen = set()
+    rdiv = 1
+    while rdiv <= 128:
+        first = max(4, -(-vco_min // (lo * rdiv)))
+        last = min(2048, vco_max // (hi * rdiv))
+        for div in range(first + (first & 1), last + 1, 2):
+            # smallest R divider wins
+            if (div == 4 or div >= 8) and ('div', div) not in seen:
+                seen.add(('div', div))
+                points.append(Point(('div', div), fixed_div(f, div, rdiv),
+                                    fixed_div(of, div, rdiv)))
+        rdiv *= 2
+    return points
+
+
+def spur_risk(point, window):
+    risk = 0.0
+    for clk in point.clocks():
+        for stage in clk.stages():
+            s = stage.spur()
+            if s and 0 < s[0] < window:
+                risk += 1.0 / s[1]
+    return risk
+
+
+def point_cost(point, opt):
+    cost = opt.spur_cost * spur_risk(point, opt.spur_window)
+    for clk in point.clocks():
+        if not clk.ms.integer:
+            cost += opt.frac_cost
+        elif clk.ms.a & 1:
+            cost += opt.frac_cost / 2
+    return cost
+
+
+def optimize(freqs, opt):
+    """
+    Viterbi over the candidate settings of each point: staying in one
+    state is free, changing state costs a PLL reset.
+    """
+    best = None
+    for freq in freqs:
+        cands = candidates(freq, opt.offset, opt.threshold, opt.vco_min, opt.vco_max)
+        # the firmware setting is always allowed
+        cur = current_point(freq, opt.offset, opt.threshold)
+        if cur.state not in [c.state for c in cands]:
+            cands.append(cur)
+        if best is None:
+            best = {c.state: (point_cost(c, opt), [c]) for c in cands}
+            continue
+        cheapest = min(best.values(), key=lambda v: v[0])
+        step = {}
+        for c in cands:
+            stay = best.get(c.state)
+            cost, path = cheapest[0] + opt.reset_cost, cheapest[1]
+            if stay is not None and stay[0] <= cost:
+                cost, path = stay
+            step[c.state] = (cost + point_cost(c, opt), path + [c])
+        best = step
+    return min(best.values(), key=lambda v: v[0])[1]
+
+
+def image(point):
+    regs = []
+    for clk in point.clocks():
+        regs.append(clk.pll.regs())
+        regs.append((clk.ms.regs(), clk.rdiv))
+    return regs
+
+
+def evaluate(plan, opt):
+    resets = 0
+    blocks = 0
+    i2c_bytes = 0
+    integer = 0
+    spurs = 0
+    error = 0.0
+    prev = None
+    for p in plan:
+        delay = DELAY_MIN
+        regs = image(p)
+        if prev is None or prev[0] != p.state:
+            if prev is not None:
+                resets += 1
+            delay += RESET_DELAY
+            i2c_bytes += 2 + 4 * 9
+        elif prev is not None:
+            # shadowed writes: only changed blocks go out
+            i2c_bytes += sum(9 for a, b in zip(regs, prev[1]) if a != b)
+        delay = min(max(delay, DELAY_MIN), DELAY_MAX)
+        blocks += 2 * delay
+        for clk in p.clocks():
+            if clk.ms.integer:
+                integer += 1
+            error = max(error, abs(clk.delivered - clk.target))
+        if spur_risk(p, opt.spur_window) > 0:
+            spurs += 1
+        prev = (p.state, regs)
+    return {
+        'resets': resets,
+        'integer': 100.0 * integer / (2 * len(plan)),
+        'spurs': spurs,
+        'error': error,
+        'time': blocks + i2c_bytes * 9 * 1000.0 / I2C_CLOCK,
+    }
+
+
+def sweep_frequencies(start, stop, points):
+    # same rounding as set_frequencies in main.c
+    span = stop - start
+    return [start + (i * span) // (points - 1) for i in range(points)]
+
+
+PRESETS = [
+    (50000, 900000000),
+    (50000, 300000000),
+    (1000000, 30000000),
+    (90000000, 200000000),
+    (140000000, 180000000),
+    (300000000, 900000000),
+    (1000000000, 2100000000),
+]
+
+
+def report(start, stop, opt):
+    freqs = sweep_frequencies(start, stop, opt.points)
+    cur = [current_point(f, opt.offset, opt.threshold) for f in freqs]
+    new = optimize(freqs, opt)
+    print("sweep %d - %d Hz, %d points" % (start, stop, opt.points))
+    print("  %-9s %6s %8s %6s %10s %9s" % ("", "resets", "integer", "spurs", "error[Hz]", "time[ms]"))
+    for name, plan in (("current", cur), ("optimized", new)):
+        m = evaluate(plan, opt)
+        print("  %-9s %6d %7.1f%% %6d %10.3f %9.1f" %
+              (name, m['resets'], m['integer'], m['spurs'], m['error'], m['time']))
+    if opt.verbose:
+        for f, c, n in zip(freqs, cur, new):
+            print("    %10d %-14s %-18s rf %.3f lo %.3f" %
+                  (f, c.state, n.state, n.rf.delivered, n.lo.delivered))
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="%prog: [options]")
+    parser.add_option("-S", "--start", dest="start",
+                      type="int", default=None,
+                      help="start frequency", metavar="START")
+    parser.add_option("-E", "--stop", dest="stop",
+                      type="int", default=None,
+                      help="stop frequency", metavar="STOP")
+    parser.add_option("-N", "--points", dest="points",
+                      type="int", default=101,
+                      help="scan points", metavar="POINTS")
+    parser.add_option("-O", "--offset", dest="offset",
+                      type="int", default=5000,
+                      help="IF offset (Hz)", metavar="OFFSET")
+    parser.add_option("-T", "--threshold", dest="threshold",
+                      type="int", default=300000000,
+                      help="harmonic mode threshold (Hz)", metavar="THRESHOLD")
+    parser.add_option("--vco-min", dest="vco_min",
+                      type="int", default=VCO_MIN,
+                      help="lowest PLL frequency", metavar="HZ")
+    parser.add_option("--vco-max", dest="vco_max",
+                      type="int", default=VCO_MAX,
+                      help="highest PLL frequency", metavar="HZ")
+    parser.add_option("--reset-cost", dest="reset_cost",
+                      type="float", default=10.0,
+                      help="cost of a PLL reset", metavar="COST")
+    parser.add_option("--spur-cost", dest="spur_cost",
+                      type="float", default=5.0,
+                      help="cost per unit of spur risk", metavar="COST")
+    parser.add_option("--frac-cost", dest="frac_cost",
+                      type="float", default=0.2,
+                      help="cost of a fractional multisynth", metavar="COST")
+    parser.add_option("--spur-window", dest="spur_window",
+                      type="float", default=10000.0,
+                      help="spur offsets below this count as risk (Hz)", metavar="HZ")
+    parser.add_option("-v", "--verbose",
+                      action="store_true", dest="verbose", default=False,
+                      help="print every point")
+    (opt, args) = parser.parse_args()
+
+    if opt.start is not None and opt.stop is not None:
+        report(opt.start, opt.stop, opt)
+    else:
+        for start, stop in PRESETS:
+            report(start, stop, opt)
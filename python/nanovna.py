@@ -203,16 +203,33 @@ class NanoVNA:
         self.resume()
         return (array0, array1)
     
-    def capture(self):
+    def capture(self, compressed=False):
         from PIL import Image
-        self.send_command("capture\r")
-        b = self.serial.read(480 * 320 * 2)
-        x = struct.unpack(">153600H", b)
+        if compressed:
+            self.send_command("capture rle\r")
+            x = self._read_rle(480 * 320)
+        else:
+            self.send_command("capture\r")
+            b = self.serial.read(480 * 320 * 2)
+            x = struct.unpack(">153600H", b)
         # convert pixel format from 565(RGB) to 8888(RGBA)
         arr = np.array(x, dtype=np.uint32)
         arr = 0xFF000000 + ((arr & 0xF800) >> 8) + ((arr & 0x07E0) << 5) + ((arr & 0x001F) << 19)
         return Image.frombuffer('RGBA', (480, 320), arr, 'raw', 'RGBA', 0, 1)
 
+    def _read_rle(self, count):
+        # header bit7 set: next pixel repeated (h&0x7f)+1 times, else h+1 literal pixels
+        x = []
+        while len(x) < count:
+            h = self.serial.read(1)[0]
+            if h & 0x80:
+                p, = struct.unpack(">H", self.serial.read(2))
+                x.extend([p] * ((h & 0x7f) + 1))
+            else:
+                n = h + 1
+                x.extend(struct.unpack(">%dH" % n, self.serial.read(n * 2)))
+        return x
+
     def logmag(self, x):
         pl.grid(True)
         pl.xlim(self.frequencies[0], self.frequencies[-1])
@@ -20,35 +20,104 @@
 #include "hal.h"
 #include "nanovna.h"
 #include "si5351.h"
+#include <string.h>
 
 #define SI5351_I2C_ADDR   	(0x60<<1)
+#define SI5351_I2C_MAX_KHZ	400     // datasheet: fast mode
 
 static bool si5351_bulk_read(uint8_t reg, uint8_t* buf, int len)
 {
-    int addr = SI5351_I2C_ADDR>>1;
-    i2cAcquireBus(&I2CD1);
-    msg_t mr = i2cMasterTransmitTimeout(&I2CD1, addr, &reg, 1, buf, len, 1000);
-    i2cReleaseBus(&I2CD1);
-    return mr == MSG_OK;
+  return i2c_read(SI5351_I2C_ADDR>>1, &reg, 1, buf, len);
 }
 
 static bool si5351_write(uint8_t reg, uint8_t dat)
 {
-  int addr = SI5351_I2C_ADDR>>1;
   uint8_t buf[] = { reg, dat };
-  i2cAcquireBus(&I2CD1);
-  msg_t mr = i2cMasterTransmitTimeout(&I2CD1, addr, buf, 2, NULL, 0, 1000);
-  i2cReleaseBus(&I2CD1);
-  return mr == MSG_OK;
+  return i2c_write(SI5351_I2C_ADDR>>1, buf, 2);
 }
 
 static bool si5351_bulk_write(const uint8_t *buf, int len)
 {
-  int addr = SI5351_I2C_ADDR>>1;
-  i2cAcquireBus(&I2CD1);
-  msg_t mr = i2cMasterTransmitTimeout(&I2CD1, addr, buf, len, NULL, 0, 1000);
-  i2cReleaseBus(&I2CD1);
-  return mr == MSG_OK;
+  return i2c_write(SI5351_I2C_ADDR>>1, buf, len);
+}
+
+/*
+ * Shadow of written registers. Only bytes that differ from the shadow are
+ * sent, unchanged runs up to SI5351_BURST_GAP bytes are sent along to keep
+ * one burst. PLL reset (177) is a command and never cached.
+ * The chip takes new PLL and multisynth P1..P3 when the last byte of
+ * their 8 byte block is written, a change sends the whole block.
+ */
+#define SI5351_REG_CACHE_SIZE 188
+#define SI5351_BURST_GAP      2
+#define SI5351_PARAM_FIRST    SI5351_REG_26_PLL_A
+#define SI5351_PARAM_END      (SI5351_REG_58_MULTISYNTH2 + 8)
+static uint8_t si5351_reg_cache[SI5351_REG_CACHE_SIZE];
+static uint8_t si5351_reg_valid[(SI5351_REG_CACHE_SIZE+7)/8];
+static uint16_t si5351_i2c_errors;    // i2c_errors the shadow is valid for
+
+#define REG_VALID(r) (si5351_reg_valid[(r)>>3] & (1<<((r)&7)))
+
+static void si5351_cache_invalidate(void)
+{
+  memset(si5351_reg_valid, 0, sizeof si5351_reg_valid);
+}
+
+static bool si5351_reg_changed(uint8_t reg, uint8_t dat)
+{
+  return !REG_VALID(reg) || si5351_reg_cache[reg] != dat;
+}
+
+// same format as si5351_bulk_write: register addr, data...
+static bool si5351_write_cached(const uint8_t *buf, int len)
+{
+  uint8_t reg = buf[0];
+  const uint8_t *data = &buf[1];
+  uint8_t burst[16];
+  int n = len - 1;
+  int i, j, last;
+  if (reg <= SI5351_REG_177_PLL_RESET && reg + n > SI5351_REG_177_PLL_RESET)
+    return si5351_bulk_write(buf, len);
+  if (reg + n > SI5351_REG_CACHE_SIZE || n >= (int)sizeof burst)
+    return si5351_bulk_write(buf, len);
+
+  for (i = 0; i < n; i = last + 1) {
+    if (!si5351_reg_changed(reg + i, data[i])) {
+      last = i;
+      continue;
+    }
+    // extend burst over next changed bytes within gap
+    last = i;
+    for (j = i + 1; j < n && j - last <= SI5351_BURST_GAP + 1; j++)
+      if (si5351_reg_changed(reg + j, data[j]))
+        last = j;
+    // and over the parameter blocks it touches
+    if (reg + i >= SI5351_PARAM_FIRST && reg + i < SI5351_PARAM_END) {
+      j = reg + i - (reg + i - SI5351_PARAM_FIRST) % 8 - reg;
+      i = j < 0 ? 0 : j;
+    }
+    if (reg + last >= SI5351_PARAM_FIRST && reg + last < SI5351_PARAM_END) {
+      j = reg + last + 7 - (reg + last - SI5351_PARAM_FIRST) % 8 - reg;
+      last = j >= n ? n - 1 : j;
+    }
+    burst[0] = reg + i;
+    memcpy(&burst[1], &data[i], last - i + 1);
+    if (!si5351_bulk_write(burst, last - i + 2)) {
+      si5351_cache_invalidate();
+      return false;
+    }
+    for (j = i; j <= last; j++) {
+      si5351_reg_cache[reg + j] = data[j];
+      si5351_reg_valid[(reg + j)>>3] |= 1<<((reg + j)&7);
+    }
+  }
+  return true;
+}
+
+static bool si5351_write_reg(uint8_t reg, uint8_t dat)
+{
+  uint8_t buf[] = { reg, dat };
+  return si5351_write_cached(buf, 2);
 }
 
 // register addr, length, data, ...
@@ -72,6 +141,8 @@ static const uint8_t si5351_configs[] = {
   0 // sentinel
 };
 
+static int current_band = -1;
+
 static bool si5351_wait_ready(void)
 {
     uint8_t status = 0xff;
@@ -109,14 +180,23 @@ static void si5351_wait_pll_lock(void)
 
 #endif
 
+static void si5351_disable_output(void);
+
 bool si5351_init(void)
 {
   if (!si5351_wait_ready())
       return false;
+  // speed test pattern for MS2, set up by si5351_configs afterwards
+  static const uint8_t tune_pattern[] = { 0xa5, 0x5a, 0x01, 0xc3, 0x3c, 0x96, 0x69, 0xf0 };
   const uint8_t *p = si5351_configs;
+  si5351_cache_invalidate();
+  current_band = -1;
+  si5351_disable_output();
+  i2c_tune(SI5351_I2C_ADDR>>1, SI5351_REG_58_MULTISYNTH2, tune_pattern, sizeof tune_pattern,
+           SI5351_I2C_MAX_KHZ);
   while (*p) {
     uint8_t len = *p++;
-    if (!si5351_bulk_write(p, len))
+    if (!si5351_write_cached(p, len))
         return false;
     p += len;
   }
@@ -126,20 +206,20 @@ bool si5351_init(void)
 static void si5351_disable_output(void)
 {
   uint8_t reg[4];
-  si5351_write(SI5351_REG_3_OUTPUT_ENABLE_CONTROL, 0xff);
+  si5351_write_reg(SI5351_REG_3_OUTPUT_ENABLE_CONTROL, 0xff);
   reg[0] = SI5351_REG_16_CLK0_CONTROL;
   reg[1] = SI5351_CLK_POWERDOWN;
   reg[2] = SI5351_CLK_POWERDOWN;
   reg[3] = SI5351_CLK_POWERDOWN;
-  si5351_bulk_write(reg, 4);
+  si5351_write_cached(reg, 4);
 }
 
 static void si5351_enable_output(void)
 {
 #ifdef __ENABLE_CLK2__
-  si5351_write(SI5351_REG_3_OUTPUT_ENABLE_CONTROL, 0x00);
+  si5351_write_reg(SI5351_REG_3_OUTPUT_ENABLE_CONTROL, 0x00);
 #else
-  si5351_write(SI5351_REG_3_OUTPUT_ENABLE_CONTROL, 0x04);
+  si5351_write_reg(SI5351_REG_3_OUTPUT_ENABLE_CONTROL, 0x04);
 #endif
 }
 
@@ -149,17 +229,41 @@ static void si5351_reset_pll(void)
   si5351_write(SI5351_REG_177_PLL_RESET, 0xAC);
 }
 
-static void si5351_setupPLL(
+static const uint8_t pllreg_base[] = {
+  SI5351_REG_26_PLL_A,
+  SI5351_REG_34_PLL_B
+};
+static const uint8_t msreg_base[] = {
+  SI5351_REG_42_MULTISYNTH0,
+  SI5351_REG_50_MULTISYNTH1,
+  SI5351_REG_58_MULTISYNTH2,
+};
+static const uint8_t clkctrl[] = {
+  SI5351_REG_16_CLK0_CONTROL,
+  SI5351_REG_17_CLK1_CONTROL,
+  SI5351_REG_18_CLK2_CONTROL
+};
+
+/* The datasheet is a nightmare of typos and inconsistencies here! */
+static void si5351_pack_params(uint8_t *reg, uint32_t P1, uint32_t P2, uint32_t P3, uint8_t msb)
+{
+  reg[0] = (P3 & 0x0000FF00) >> 8;
+  reg[1] = (P3 & 0x000000FF);
+  reg[2] = ((P1 & 0x00030000) >> 16) | msb;
+  reg[3] = (P1 & 0x0000FF00) >> 8;
+  reg[4] = (P1 & 0x000000FF);
+  reg[5] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
+  reg[6] = (P2 & 0x0000FF00) >> 8;
+  reg[7] = (P2 & 0x000000FF);
+}
+
+static void si5351_plan_pll(
+    si5351_plan_t *plan,
     uint8_t     pll, /* SI5351_PLL_A or SI5351_PLL_B */
     uint8_t     mult,
     uint32_t    num,
     uint32_t    denom)
 {
-  /* Get the appropriate starting point for the PLL registers */
-  const uint8_t pllreg_base[] = {
-    SI5351_REG_26_PLL_A,
-    SI5351_REG_34_PLL_B
-  };
   uint32_t P1;
   uint32_t P2;
   uint32_t P3;
@@ -191,22 +295,11 @@ static void si5351_setupPLL(
     P2 = 128 * num - denom * ((128 * num) / denom);
     P3 = denom;
   }
-
-  /* The datasheet is a nightmare of typos and inconsistencies here! */
-  uint8_t reg[9];
-  reg[0] = pllreg_base[pll];
-  reg[1] = (P3 & 0x0000FF00) >> 8;
-  reg[2] = (P3 & 0x000000FF);
-  reg[3] = (P1 & 0x00030000) >> 16;
-  reg[4] = (P1 & 0x0000FF00) >> 8;
-  reg[5] = (P1 & 0x000000FF);
-  reg[6] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
-  reg[7] = (P2 & 0x0000FF00) >> 8;
-  reg[8] = (P2 & 0x000000FF);
-  si5351_bulk_write(reg, 9);
+  si5351_pack_params(plan->pll[pll], P1, P2, P3, 0);
 }
 
-static void si5351_setupMultisynth(
+static void si5351_plan_multisynth(
+    si5351_plan_t *plan,
     uint8_t     output,
     uint8_t	    pllSource,
     uint32_t    div, // 4,6,8, 8+ ~ 900
@@ -215,17 +308,6 @@ static void si5351_setupMultisynth(
     uint32_t    rdiv, // SI5351_R_DIV_1~128
     uint8_t     drive_strength)
 {
-  /* Get the appropriate starting point for the PLL registers */
-  const uint8_t msreg_base[] = {
-    SI5351_REG_42_MULTISYNTH0,
-    SI5351_REG_50_MULTISYNTH1,
-    SI5351_REG_58_MULTISYNTH2,
-  };
-  const uint8_t clkctrl[] = {
-    SI5351_REG_16_CLK0_CONTROL,
-    SI5351_REG_17_CLK1_CONTROL,
-    SI5351_REG_18_CLK2_CONTROL
-  };
   uint8_t dat;
 
   uint32_t P1;
@@ -260,17 +342,7 @@ static void si5351_setupMultisynth(
   }
 
   /* Set the MSx config registers */
-  uint8_t reg[9];
-  reg[0] = msreg_base[output];
-  reg[1] = (P3 & 0x0000FF00) >> 8;
-  reg[2] = (P3 & 0x000000FF);
-  reg[3] = ((P1 & 0x00030000) >> 16) | div4 | rdiv;
-  reg[4] = (P1 & 0x0000FF00) >> 8;
-  reg[5] = (P1 & 0x000000FF);
-  reg[6] = ((P3 & 0x000F0000) >> 12) | ((P2 & 0x000F0000) >> 16);
-  reg[7] = (P2 & 0x0000FF00) >> 8;
-  reg[8] = (P2 & 0x000000FF);
-  si5351_bulk_write(reg, 9);
+  si5351_pack_params(plan->ms[output], P1, P2, P3, div4 | rdiv);
 
   /* Configure the clk control and enable the output */
   dat = drive_strength | SI5351_CLK_INPUT_MULTISYNTH_N;
@@ -278,7 +350,26 @@ static void si5351_setupMultisynth(
     dat |= SI5351_CLK_PLL_SELECT_B;
   if (num == 0)
     dat |= SI5351_CLK_INTEGER_MODE;
-  si5351_write(clkctrl[output], dat);
+  plan->clk_control[output] = dat;
+}
+
+static void si5351_write_block(uint8_t base, const uint8_t *data)
+{
+  uint8_t reg[9];
+  reg[0] = base;
+  memcpy(&reg[1], data, 8);
+  si5351_write_cached(reg, 9);
+}
+
+static void si5351_setupPLL(const si5351_plan_t *plan, uint8_t pll)
+{
+  si5351_write_block(pllreg_base[pll], plan->pll[pll]);
+}
+
+static void si5351_setupMultisynth(const si5351_plan_t *plan, uint8_t output)
+{
+  si5351_write_block(msreg_base[output], plan->ms[output]);
+  si5351_write_reg(clkctrl[output], plan->clk_control[output]);
 }
 
 static uint32_t gcd(uint32_t x, uint32_t y)
@@ -297,6 +388,7 @@ static uint32_t gcd(uint32_t x, uint32_t y)
 #define PLLFREQ (XTALFREQ * PLL_N)
 
 static void si5351_set_frequency_fixedpll(
+    si5351_plan_t *plan,
     int channel, int pll, int pllfreq, int freq,
     uint32_t rdiv, uint8_t drive_strength)
 {
@@ -311,10 +403,11 @@ static void si5351_set_frequency_fixedpll(
       num >>= 1;
       denom >>= 1;
     }
-    si5351_setupMultisynth(channel, pll, div, num, denom, rdiv, drive_strength);
+    si5351_plan_multisynth(plan, channel, pll, div, num, denom, rdiv, drive_strength);
 }
 
 static void si5351_set_frequency_fixeddiv(
+    si5351_plan_t *plan,
     int channel, int pll, int freq, int div,
     uint8_t     drive_strength)
 {
@@ -329,8 +422,8 @@ static void si5351_set_frequency_fixeddiv(
       num >>= 1;
       denom >>= 1;
     }
-    si5351_setupPLL(pll, multi, num, denom);
-    si5351_setupMultisynth(channel, pll, div, 0, 1, SI5351_R_DIV_1, drive_strength);
+    si5351_plan_pll(plan, pll, multi, num, denom);
+    si5351_plan_multisynth(plan, channel, pll, div, 0, 1, SI5351_R_DIV_1, drive_strength);
 }
 
 /* 
@@ -340,43 +433,40 @@ static void si5351_set_frequency_fixeddiv(
  */
 void si5351_set_frequency(int channel, int freq, uint8_t drive_strength)
 {
+  si5351_plan_t plan;
   if (freq <= 100000000) {
-    si5351_setupPLL(SI5351_PLL_B, 32, 0, 1);
-    si5351_set_frequency_fixedpll(channel, SI5351_PLL_B, PLLFREQ, freq, SI5351_R_DIV_1, drive_strength);
+    si5351_plan_pll(&plan, SI5351_PLL_B, 32, 0, 1);
+    si5351_set_frequency_fixedpll(&plan, channel, SI5351_PLL_B, PLLFREQ, freq, SI5351_R_DIV_1, drive_strength);
   } else if (freq < 150000000) {
-    si5351_set_frequency_fixeddiv(channel, SI5351_PLL_B, freq, 6, drive_strength);
+    si5351_set_frequency_fixeddiv(&plan, channel, SI5351_PLL_B, freq, 6, drive_strength);
   } else {
-    si5351_set_frequency_fixeddiv(channel, SI5351_PLL_B, freq, 4, drive_strength);
+    si5351_set_frequency_fixeddiv(&plan, channel, SI5351_PLL_B, freq, 4, drive_strength);
   }
+  si5351_setupPLL(&plan, SI5351_PLL_B);
+  si5351_setupMultisynth(&plan, channel);
 }
 
 
-static int current_band = -1;
-
 /*
  * configure output as follows:
  * CLK0: frequency + offset
  * CLK1: frequency
  * CLK2: fixed 8MHz
+ *
+ * Planning computes all register images of a point without touching the
+ * chip, so a sweep can plan its points once and only replay them.
  */
 #define CLK2_FREQUENCY 8000000L
-int si5351_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_strength)
+void si5351_plan_frequency(si5351_plan_t *plan, uint32_t freq, int offset, uint8_t drive_strength)
 {
   int band;
-  int delay = 3;
   uint32_t ofreq = freq + offset;
   uint32_t rdiv = SI5351_R_DIV_1;
- /* if (freq > config.harmonic_freq_threshold * 5 ) {
-	    freq /= 7;
-	    ofreq /= 9;
-  }else */
-	  if (freq > config.harmonic_freq_threshold * 3) {
-    freq /= 5;
-    ofreq /= 7;
-  } else if (freq > config.harmonic_freq_threshold) {
-    freq /= 3;
-    ofreq /= 5;
-  }
+  const harmonic_t *h = get_harmonic(freq);
+  plan->rf_harmonic = h->rf_harmonic;
+  plan->lo_harmonic = h->lo_harmonic;
+  freq /= h->rf_harmonic;
+  ofreq /= h->lo_harmonic;
   if (freq <= 100000000) {
     band = 0;
   } else if (freq < 160000000) {
@@ -389,19 +479,13 @@ int si5351_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_st
   } else if (freq <= 4000000) {
     rdiv = SI5351_R_DIV_8;
   }
-
-#if 1
-  if (current_band != band)
-    si5351_disable_output();
-#endif
+  plan->band = band;
 
   switch (band) {
   case 0:
     // fractional divider mode. only PLL A is used.
-    if (current_band == 1 || current_band == 2){
-    	si5351_reset_pll();
-    	si5351_setupPLL(SI5351_PLL_A, 32, 0, 1);
-    }
+    // PLL A is set up only when coming from band 1 or 2
+    si5351_plan_pll(plan, SI5351_PLL_A, 32, 0, 1);
 
     if (rdiv == SI5351_R_DIV_8) {
       freq *= 8;
@@ -411,40 +495,114 @@ int si5351_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_st
       ofreq *= 64;
     }
 
-    si5351_set_frequency_fixedpll(0, SI5351_PLL_A, PLLFREQ, ofreq,
+    si5351_set_frequency_fixedpll(plan, 0, SI5351_PLL_A, PLLFREQ, ofreq,
                                   rdiv, drive_strength);
-    si5351_set_frequency_fixedpll(1, SI5351_PLL_A, PLLFREQ, freq,
+    si5351_set_frequency_fixedpll(plan, 1, SI5351_PLL_A, PLLFREQ, freq,
                                   rdiv, drive_strength);
-    //if (current_band != 0)
 #ifdef __ENABLE_CLK2__
-      si5351_set_frequency_fixedpll(2, SI5351_PLL_A, PLLFREQ, CLK2_FREQUENCY,
+      si5351_set_frequency_fixedpll(plan, 2, SI5351_PLL_A, PLLFREQ, CLK2_FREQUENCY,
                                     SI5351_R_DIV_1, SI5351_CLK_DRIVE_STRENGTH_2MA);
 #endif
     break;
 
   case 1:
-    // Set PLL twice on changing from band 2
-    if (current_band == 2) {
-      si5351_set_frequency_fixeddiv(0, SI5351_PLL_A, ofreq, 6, drive_strength);
-      si5351_set_frequency_fixeddiv(1, SI5351_PLL_B, freq, 6, drive_strength);
-    }
-
     // div by 6 mode. both PLL A and B are dedicated for CLK0, CLK1
-    si5351_set_frequency_fixeddiv(0, SI5351_PLL_A, ofreq, 6, drive_strength);
-    si5351_set_frequency_fixeddiv(1, SI5351_PLL_B, freq, 6, drive_strength);
+    si5351_set_frequency_fixeddiv(plan, 0, SI5351_PLL_A, ofreq, 6, drive_strength);
+    si5351_set_frequency_fixeddiv(plan, 1, SI5351_PLL_B, freq, 6, drive_strength);
 #ifdef __ENABLE_CLK2__
-    si5351_set_frequency_fixedpll(2, SI5351_PLL_B, freq * 6, CLK2_FREQUENCY,
+    si5351_set_frequency_fixedpll(plan, 2, SI5351_PLL_B, freq * 6, CLK2_FREQUENCY,
                                   SI5351_R_DIV_1, SI5351_CLK_DRIVE_STRENGTH_2MA);
 #endif
     break;
 
   case 2:
     // div by 4 mode. both PLL A and B are dedicated for CLK0, CLK1
-    si5351_set_frequency_fixeddiv(0, SI5351_PLL_A, ofreq, 4, drive_strength);
-    si5351_set_frequency_fixeddiv(1, SI5351_PLL_B, freq, 4, drive_strength);
+    si5351_set_frequency_fixeddiv(plan, 0, SI5351_PLL_A, ofreq, 4, drive_strength);
+    si5351_set_frequency_fixeddiv(plan, 1, SI5351_PLL_B, freq, 4, drive_strength);
 #ifdef __ENABLE_CLK2__
-    si5351_set_frequency_fixedpll(2, SI5351_PLL_B, freq * 4, CLK2_FREQUENCY,
+    si5351_set_frequency_fixedpll(plan, 2, SI5351_PLL_B, freq * 4, CLK2_FREQUENCY,
                                   SI5351_R_DIV_1, SI5351_CLK_DRIVE_STRENGTH_2MA);
+#endif
+    break;
+  }
+}
+
+// a + b/c of a packed PLL or multisynth parameter block
+static double si5351_plan_ratio(const uint8_t *reg)
+{
+  uint32_t P1 = ((reg[2] & 0x03) << 16) | (reg[3] << 8) | reg[4];
+  uint32_t P2 = ((reg[5] & 0x0f) << 16) | (reg[6] << 8) | reg[7];
+  uint32_t P3 = ((reg[5] & 0xf0) << 12) | (reg[0] << 8) | reg[1];
+  // (P1 + 512) * P3 + P2 = 128 * (a * c + b)
+  return ((double)(P1 + 512) * P3 + P2) / (128.0 * P3);
+}
+
+static double si5351_plan_output(const si5351_plan_t *plan, int output)
+{
+  int pll = (plan->clk_control[output] & SI5351_CLK_PLL_SELECT_B) ? SI5351_PLL_B : SI5351_PLL_A;
+  int rdiv = 1 << ((plan->ms[output][2] >> 4) & 7);
+  return XTALFREQ * si5351_plan_ratio(plan->pll[pll]) / si5351_plan_ratio(plan->ms[output]) / rdiv;
+}
+
+/*
+ * Delivered minus requested frequency of RF (CLK1) and LO (CLK0), from
+ * the registers actually sent: denominators are truncated to 20 bits and
+ * harmonic fundamentals are rounded down.
+ */
+void si5351_plan_error(const si5351_plan_t *plan, uint32_t freq, int offset, float *rf_error, float *lo_error)
+{
+  *rf_error = si5351_plan_output(plan, 1) * plan->rf_harmonic - freq;
+  *lo_error = si5351_plan_output(plan, 0) * plan->lo_harmonic - ((double)freq + offset);
+}
+
+// send a planned point, returns settling delay
+int si5351_apply_plan(const si5351_plan_t *plan)
+{
+  int band = plan->band;
+  int delay = 3;
+
+  // a queued write failed since, the shadow can't be trusted
+  if (si5351_i2c_errors != i2c_errors) {
+    si5351_i2c_errors = i2c_errors;
+    si5351_cache_invalidate();
+  }
+
+#if 1
+  if (current_band != band)
+    si5351_disable_output();
+#endif
+
+  switch (band) {
+  case 0:
+    if (current_band == 1 || current_band == 2){
+    	si5351_reset_pll();
+    	si5351_setupPLL(plan, SI5351_PLL_A);
+    }
+    si5351_setupMultisynth(plan, 0);
+    si5351_setupMultisynth(plan, 1);
+#ifdef __ENABLE_CLK2__
+    si5351_setupMultisynth(plan, 2);
+#endif
+    break;
+
+  case 1:
+    // Set PLL twice on changing from band 2
+    if (current_band == 2) {
+      si5351_setupPLL(plan, SI5351_PLL_A);
+      si5351_setupMultisynth(plan, 0);
+      si5351_setupPLL(plan, SI5351_PLL_B);
+      si5351_setupMultisynth(plan, 1);
+      // force second write
+      si5351_cache_invalidate();
+    }
+    /* FALLTHROUGH */
+  case 2:
+    si5351_setupPLL(plan, SI5351_PLL_A);
+    si5351_setupMultisynth(plan, 0);
+    si5351_setupPLL(plan, SI5351_PLL_B);
+    si5351_setupMultisynth(plan, 1);
+#ifdef __ENABLE_CLK2__
+    si5351_setupMultisynth(plan, 2);
 #endif
     break;
   }
@@ -461,3 +619,10 @@ int si5351_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_st
   current_band = band;
   return delay;
 }
+
+int si5351_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_strength)
+{
+  si5351_plan_t plan;
+  si5351_plan_frequency(&plan, freq, offset, drive_strength);
+  return si5351_apply_plan(&plan);
+}
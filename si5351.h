@@ -78,8 +78,24 @@
 
 #define SI5351_CRYSTAL_FREQ_25MHZ 	25000000
 
+/*
+ * Register images of one synthesizer setting: band selects the
+ * band-change actions taken when it is sent.
+ */
+typedef struct {
+  uint8_t band;
+  uint8_t rf_harmonic;  // harmonic of CLK1 used as RF
+  uint8_t lo_harmonic;  // harmonic of CLK0 used as LO
+  uint8_t clk_control[3];
+  uint8_t pll[2][8];  // PLL A, B parameter registers
+  uint8_t ms[3][8];   // multisynth 0..2 parameter registers
+} si5351_plan_t;
+
 bool si5351_init(void);
 void si5351_set_frequency(int channel, int freq, uint8_t drive_strength);
 int si5351_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_strength);
+void si5351_plan_frequency(si5351_plan_t *plan, uint32_t freq, int offset, uint8_t drive_strength);
+int si5351_apply_plan(const si5351_plan_t *plan);
+void si5351_plan_error(const si5351_plan_t *plan, uint32_t freq, int offset, float *rf_error, float *lo_error);
 
 #endif //__SI5351_H__
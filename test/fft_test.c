@@ -0,0 +1,248 @@
+/*
+ * Host accuracy test and benchmark of fft.h.
+ *
+ * Every power of two size up to FFT_TABLE_SIZE is checked against a
+ * double precision DFT, forward, inverse and real inverse, and the SNR
+ * must reach MIN_SNR_DB. Times are per transform, the old fft256 with
+ * libm twiddles and the reference DFT are timed for comparison.
+ * Built with __USE_FFT_Q15__ it tests the fixed point FFT of the F072.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+#include "../fft.h"
+
+#ifndef MIN_SNR_DB
+#define MIN_SNR_DB 100
+#endif
+
+#define RUNS 200
+
+#define STR(x)  #x
+#define XSTR(x) STR(x)
+
+static uint16_t reverse_bits(uint16_t x, int n) {
+	uint16_t result = 0;
+	for (int i = 0; i < n; i++, x >>= 1)
+		result = (result << 1) | (x & 1U);
+	return result;
+}
+
+// fft256 as it was before the table driven FFT
+static void fft256_old(float array[][2], const uint8_t dir) {
+	const uint16_t n = 256;
+	const uint8_t levels = 8; // log2(n)
+
+	const uint8_t real =   dir & 1;
+	const uint8_t imag = ~real & 1;
+
+	for (uint16_t i = 0; i < n; i++) {
+		uint16_t j = reverse_bits(i, levels);
+		if (j > i) {
+			float temp = array[i][real];
+			array[i][real] = array[j][real];
+			array[j][real] = temp;
+			temp = array[i][imag];
+			array[i][imag] = array[j][imag];
+			array[j][imag] = temp;
+		}
+	}
+
+	for (uint16_t size = 2; size <= n; size *= 2) {
+		uint16_t halfsize = size / 2;
+		uint16_t tablestep = n / size;
+		for (uint16_t i = 0; i < n; i += size) {
+			for (uint16_t j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
+				uint16_t l = j + halfsize;
+				float tpre =  array[l][real] * cos(2 * M_PI * k / 256) + array[l][imag] * sin(2 * M_PI * k / 256);
+				float tpim = -array[l][real] * sin(2 * M_PI * k / 256) + array[l][imag] * cos(2 * M_PI * k / 256);
+				array[l][real] = array[j][real] - tpre;
+				array[l][imag] = array[j][imag] - tpim;
+				array[j][real] += tpre;
+				array[j][imag] += tpim;
+			}
+		}
+		if (size == n)
+			break;
+	}
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double now_cycles(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// X[k] = sum x[m] exp(-+j*2*pi*m*k/n), unscaled like fft()
+static void dft(const double x[][2], double X[][2], int n, int dir)
+{
+	for (int k = 0; k < n; k++) {
+		double re = 0, im = 0;
+		for (int m = 0; m < n; m++) {
+			double th = (dir ? 2 : -2) * M_PI * (double)((m * k) % n) / n;
+			re += x[m][0] * cos(th) - x[m][1] * sin(th);
+			im += x[m][0] * sin(th) + x[m][1] * cos(th);
+		}
+		X[k][0] = re;
+		X[k][1] = im;
+	}
+}
+
+static double snr_db(const double ref[][2], const float out[][2], int n)
+{
+	double err = 0, pow = 0;
+	for (int k = 0; k < n; k++) {
+		double dr = ref[k][0] - out[k][0];
+		double di = ref[k][1] - out[k][1];
+		err += dr * dr + di * di;
+		pow += ref[k][0] * ref[k][0] + ref[k][1] * ref[k][1];
+	}
+	return err == 0 ? 999 : 10 * log10(pow / err);
+}
+
+static double random_input(double x[][2], int n, double scale)
+{
+	for (int i = 0; i < n; i++) {
+		x[i][0] = (rand() / (double)RAND_MAX - 0.5) * scale;
+		x[i][1] = (rand() / (double)RAND_MAX - 0.5) * scale;
+	}
+	return scale;
+}
+
+static int failed = 0;
+
+static void report(const char *name, int n, double snr)
+{
+	int ok = snr >= MIN_SNR_DB;
+	printf("%-12s n=%3d snr %6.1f dB%s\n", name, n, snr, ok ? "" : "  FAIL");
+	if (!ok)
+		failed++;
+}
+
+static void test_complex(const char *name, int n, int dir, double scale)
+{
+	static double x[FFT_TABLE_SIZE][2], X[FFT_TABLE_SIZE][2];
+	static float a[FFT_TABLE_SIZE][2];
+	random_input(x, n, scale);
+	for (int i = 0; i < n; i++) {
+		a[i][0] = x[i][0];
+		a[i][1] = x[i][1];
+	}
+	dft(x, X, n, dir);
+	FFT_TRANSFORM(a, n, dir);
+	report(name, n, snr_db(X, a, n));
+}
+
+// time domain response of a 101 point sweep: a windowless tone padded with zeros
+static void test_tone(void)
+{
+	static double x[FFT_SIZE][2], X[FFT_SIZE][2];
+	static float a[FFT_SIZE][2];
+	for (int i = 0; i < FFT_SIZE; i++) {
+		double th = 2 * M_PI * i * 17.3 / FFT_SIZE;
+		x[i][0] = a[i][0] = i < 101 ? cos(th) : 0;
+		x[i][1] = a[i][1] = i < 101 ? sin(th) : 0;
+	}
+	dft(x, X, FFT_SIZE, 1);
+	fft_inverse(a);
+	report("tone", FFT_SIZE, snr_db(X, a, FFT_SIZE));
+}
+
+static void test_real_inverse(int n)
+{
+	static double x[FFT_TABLE_SIZE][2], X[FFT_TABLE_SIZE][2];
+	static float a[FFT_TABLE_SIZE/2][2], out[FFT_TABLE_SIZE][2];
+	random_input(x, n / 2 + 1, 1);
+	x[0][1] = x[n/2][1] = 0;
+	for (int k = 1; k < n / 2; k++) {
+		x[n-k][0] =  x[k][0];
+		x[n-k][1] = -x[k][1];
+	}
+	for (int k = 0; k < n / 2; k++) {
+		a[k][0] = x[k][0];
+		a[k][1] = x[k][1];
+	}
+	a[0][1] = x[n/2][0];
+	dft(x, X, n, 1);
+	fft_real_inverse(a, n);
+	for (int i = 0; i < n; i++) {
+		out[i][0] = ((float *)a)[i];
+		out[i][1] = 0;
+	}
+	report("real inverse", n, snr_db(X, out, n));
+}
+
+static void bench(const char *name, void (*f)(float [][2]))
+{
+	static float a[FFT_SIZE][2];
+	double t = now_ns();
+	double c = now_cycles();
+	for (int r = 0; r < RUNS; r++) {
+		for (int i = 0; i < FFT_SIZE; i++) {
+			a[i][0] = i & 7;
+			a[i][1] = i & 3;
+		}
+		f(a);
+	}
+	c = (now_cycles() - c) / RUNS;
+	t = (now_ns() - t) / RUNS;
+	printf("%-13s n=%3d %9.0f ns %10.0f cycles\n", name, FFT_SIZE, t, c);
+}
+
+static void run_fft(float a[][2])
+{
+	fft_inverse(a);
+}
+
+static void run_fft256_old(float a[][2])
+{
+	fft256_old(a, 1);
+}
+
+static void run_dft(float a[][2])
+{
+	static double x[FFT_SIZE][2], X[FFT_SIZE][2];
+	for (int i = 0; i < FFT_SIZE; i++) {
+		x[i][0] = a[i][0];
+		x[i][1] = a[i][1];
+	}
+	dft(x, X, FFT_SIZE, 1);
+}
+
+int main(void)
+{
+	srand(1);
+	for (int n = 2; n <= FFT_TABLE_SIZE; n *= 2) {
+		test_complex("forward", n, 0, 1);
+		test_complex("inverse", n, 1, 1);
+	}
+	// block floating point must keep small inputs as accurate
+	test_complex("forward/1e3", FFT_TABLE_SIZE, 0, 1e-3);
+	test_complex("inverse/1e3", FFT_TABLE_SIZE, 1, 1e-3);
+	for (int n = 4; n <= FFT_TABLE_SIZE; n *= 2)
+		test_real_inverse(n);
+	test_tone();
+
+	bench(XSTR(FFT_TRANSFORM), run_fft);
+	bench("fft256 old", run_fft256_old);
+	bench("dft", run_dft);
+
+	if (failed)
+		printf("%d FAILED\n", failed);
+	return failed != 0;
+}
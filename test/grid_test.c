@@ -0,0 +1,138 @@
+/*
+ * Host test of the grid drawing in plot.c: every cell draw_cell sends
+ * must match the grid evaluated pixel by pixel with the geometry tests,
+ * also when the grid was first drawn black and the colour set after.
+ * The per-pixel evaluation is what draw_cell did before the grid masks,
+ * both are timed.
+ */
+#include <stdio.h>
+#include <time.h>
+#include "plot.c"
+
+#define GRID_COLOR 0x1084
+#define RUNS 20
+
+extern uint16_t lcd[LCD_HEIGHT][LCD_WIDTH];
+static uint16_t ref[LCD_HEIGHT][LCD_WIDTH];
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void setup(int type)
+{
+  int t;
+  for (t = 0; t < TRACE_COUNT; t++)
+    trace[t].enabled = 0;
+  trace[0].enabled = 1;
+  trace[0].type = type;
+  trace[0].scale = 1;
+  for (t = 0; t < MARKER_COUNT; t++)
+    markers[t].enabled = 0;
+  active_marker = -1;
+  sweep_points = 1;
+  frequency0 = 50000;
+  frequency1 = 900000000;
+  update_grid();
+}
+
+static void draw_screen(void)
+{
+  int m, n;
+  memset(lcd, 0, sizeof lcd);
+  for (n = 0; n * CELLHEIGHT < area_height; n++)
+    for (m = 0; m * CELLWIDTH < area_width + CELLOFFSETX; m++)
+      draw_cell(m, n);
+}
+
+// grid of the cells draw_screen covers, one geometry test per pixel
+static void draw_ref(int type)
+{
+  int x, y;
+  memset(ref, 0, sizeof ref);
+  for (y = 0; y < area_height; y++) {
+    for (x = -CELLOFFSETX; x < area_width - CELLOFFSETX; x++) {
+      int c;
+      if (type == TRC_SMITH)
+        c = smith_grid(x, y);
+      else if (type == TRC_POLAR)
+        c = polar_grid(x, y);
+      else
+        c = (rectangular_grid_x(x) || (rectangular_grid_y(y) && x >= 0 && x <= WIDTH));
+      ref[OFFSETY + y][OFFSETX + x] = c ? config.grid_color : 0;
+    }
+  }
+}
+
+static int compare_screen(const char *name, int skip_x)
+{
+  int x, y, diff = 0;
+  for (y = 0; y < area_height; y++)
+    for (x = OFFSETX - CELLOFFSETX + skip_x; x < OFFSETX - CELLOFFSETX + area_width; x++)
+      if (lcd[OFFSETY + y][x] != ref[OFFSETY + y][x])
+        diff++;
+  printf("%-28s %s", name, diff ? "FAIL" : "ok");
+  if (diff)
+    printf(" (%d pixels)", diff);
+  printf("\n");
+  return diff != 0;
+}
+
+static int test_grid(const char *name, int type, int skip_x)
+{
+  char buf[64];
+  int failed = 0;
+  // the grid bits are built by update_grid and at the first draw of a
+  // mode, build them while black
+  config.grid_color = 0;
+  setup(type);
+  draw_screen();
+  draw_ref(type);
+  snprintf(buf, sizeof buf, "%s black", name);
+  failed += compare_screen(buf, skip_x);
+
+  config.grid_color = GRID_COLOR;
+  draw_screen();
+  draw_ref(type);
+  snprintf(buf, sizeof buf, "%s colour restored", name);
+  failed += compare_screen(buf, skip_x);
+
+  double t = now_us();
+  for (int r = 0; r < RUNS; r++)
+    draw_screen();
+  double t_cell = (now_us() - t) / RUNS;
+  t = now_us();
+  for (int r = 0; r < RUNS; r++)
+    draw_ref(type);
+  double t_ref = (now_us() - t) / RUNS;
+  printf("%-28s draw_cell %7.0f us/screen, per-pixel grid %7.0f us/screen\n", name, t_cell, t_ref);
+  return failed;
+}
+
+// with grid_width unset (zero span) the frame and rows are still drawn
+static int test_zero_span(void)
+{
+  config.grid_color = GRID_COLOR;
+  setup(TRC_LOGMAG);
+  grid_width = 0;
+  update_rectangular_grid();
+  draw_screen();
+  draw_ref(TRC_LOGMAG);
+  return compare_screen("rectangular zero span", CELLWIDTH - CELLOFFSETX);
+}
+
+int main(void)
+{
+  int failed = 0;
+  failed += test_grid("smith", TRC_SMITH, 0);
+  failed += test_grid("polar", TRC_POLAR, 0);
+  // reference position marks are drawn on the cells of column 0
+  failed += test_grid("rectangular", TRC_LOGMAG, CELLWIDTH - CELLOFFSETX);
+  failed += test_zero_span();
+  if (failed)
+    printf("%d FAILED\n", failed);
+  return failed != 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Host test of the queued I2C writes of i2c.c (__I2C_ASYNC__) against a
+ * mock i2cMasterTransmitTimeout that takes the bus time of each burst at
+ * the configured speed and logs it with timestamps and calling thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "i2c.c"
+
+#define LOG_SIZE 64
+
+typedef struct {
+  uint8_t addr;
+  uint8_t len;
+  uint8_t data[32];
+  int read;
+  int khz;
+  pthread_t thread;
+  double start, end;
+} burst_t;
+
+static burst_t bursts[LOG_SIZE];
+static int burst_count;
+static int fail_count;    // following bursts to fail
+static uint8_t regs[128][256];    // register file of each address
+static pthread_mutex_t bus = PTHREAD_MUTEX_INITIALIZER;
+
+static I2C_TypeDef i2c1_regs;
+static SYSCFG_TypeDef syscfg_regs;
+I2CDriver I2CD1 = { &i2c1_regs };
+SYSCFG_TypeDef *SYSCFG = &syscfg_regs;
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void i2cStart(I2CDriver *i2cp, const I2CConfig *config)
+{
+  i2cp->i2c->TIMINGR = config->timingr;
+}
+
+void i2cStop(I2CDriver *i2cp)
+{
+  (void)i2cp;
+}
+
+void i2cAcquireBus(I2CDriver *i2cp)
+{
+  (void)i2cp;
+  pthread_mutex_lock(&bus);
+}
+
+void i2cReleaseBus(I2CDriver *i2cp)
+{
+  (void)i2cp;
+  pthread_mutex_unlock(&bus);
+}
+
+static int bus_khz(void)
+{
+  for (int i = 0; i < I2C_SPEED_COUNT; i++)
+    if (i2c_speeds[i].timingr == I2CD1.i2c->TIMINGR)
+      return i2c_speeds[i].khz;
+  return 0;
+}
+
+// 9 clocks per byte, address bytes included. Writes store from the
+// register in txbuf[0] on, reads return from it
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, uint8_t addr,
+                               const uint8_t *txbuf, size_t txbytes,
+                               uint8_t *rxbuf, size_t rxbytes,
+                               sysinterval_t timeout)
+{
+  (void)i2cp;
+  (void)timeout;
+  burst_t *b = &bursts[burst_count < LOG_SIZE ? burst_count++ : LOG_SIZE - 1];
+  int bytes = 1 + txbytes + (rxbytes ? 1 + rxbytes : 0);
+  b->addr = addr;
+  b->len = txbytes < sizeof b->data ? txbytes : sizeof b->data;
+  memcpy(b->data, txbuf, b->len);
+  b->read = rxbytes != 0;
+  b->khz = bus_khz();
+  b->thread = pthread_self();
+  b->start = now_us();
+  chThdSleepMicroseconds(bytes * 9 * 1000 / b->khz);
+  uint8_t *reg = &regs[addr & 0x7f][txbuf[0]];
+  if (rxbytes)
+    memcpy(rxbuf, reg, rxbytes);
+  else
+    memcpy(reg, &txbuf[1], txbytes - 1);
+  b->end = now_us();
+  if (fail_count > 0) {
+    fail_count--;
+    return MSG_RESET;
+  }
+  return MSG_OK;
+}
+
+static int failed;
+
+static void check(int ok, const char *what)
+{
+  printf("%-48s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failed++;
+}
+
+static void fill(uint8_t *buf, int len, int seq)
+{
+  for (int i = 0; i < len; i++)
+    buf[i] = seq + i;
+}
+
+static int burst_is(const burst_t *b, uint8_t addr, int len, int seq)
+{
+  uint8_t buf[32];
+  fill(buf, len, seq);
+  return b->addr == addr && b->len == len && !b->read && memcmp(b->data, buf, len) == 0;
+}
+
+// more bursts than the ring holds, sent in order by the i2c thread
+static void test_order(void)
+{
+  uint8_t buf[I2C_QUEUE_DATA];
+  double returned[20];
+  int i, ok;
+  burst_count = 0;
+  for (i = 0; i < 20; i++) {
+    fill(buf, 9, i);
+    i2c_write(0x60, buf, 9);
+    returned[i] = now_us();
+  }
+  i2c_flush();
+  double flushed = now_us();
+  ok = burst_count == 20;
+  for (i = 0; ok && i < 20; i++)
+    ok = burst_is(&bursts[i], 0x60, 9, i) && !pthread_equal(bursts[i].thread, pthread_self());
+  check(ok, "queued bursts sent in order by the i2c thread");
+  check(returned[0] < bursts[0].end, "i2c_write returns while its burst is on the bus");
+  check(i2c_busy == 0 && flushed >= bursts[burst_count - 1].end, "i2c_flush returns after the last burst");
+}
+
+#define FLUSH_WAITERS 3
+static volatile int flush_returned;
+
+static void *flush_thread(void *arg)
+{
+  (void)arg;
+  i2c_flush();
+  __sync_fetch_and_add(&flush_returned, 1);
+  return NULL;
+}
+
+// every thread waiting in i2c_flush returns when the ring drains
+static void test_flush_waiters(void)
+{
+  uint8_t buf[9];
+  pthread_t t[FLUSH_WAITERS];
+  int i;
+  fill(buf, sizeof buf, 0);
+  for (i = 0; i < 4; i++)
+    i2c_write(0x60, buf, sizeof buf);
+  flush_returned = 0;
+  for (i = 0; i < FLUSH_WAITERS; i++)
+    pthread_create(&t[i], NULL, flush_thread, NULL);
+  for (i = 0; i < 100 && flush_returned < FLUSH_WAITERS; i++)
+    chThdSleepMilliseconds(1);
+  check(flush_returned == FLUSH_WAITERS, "i2c_flush wakes all waiting threads");
+  for (i = 0; i < FLUSH_WAITERS; i++)
+    if (flush_returned == FLUSH_WAITERS)
+      pthread_join(t[i], NULL);
+    else
+      pthread_detach(t[i]);
+}
+
+// reads and writes too long for a slot wait for the ring, then go synchronous
+static void test_sync(void)
+{
+  uint8_t buf[I2C_QUEUE_DATA + 4];
+  uint8_t reg = 0, rd[2];
+  int i, ok;
+  burst_count = 0;
+  for (i = 0; i < 3; i++) {
+    fill(buf, 9, i);
+    i2c_write(0x60, buf, 9);
+  }
+  fill(buf, sizeof buf, 3);
+  bool sent = i2c_write(0x60, buf, sizeof buf);
+  double returned = now_us();
+  ok = burst_count == 4;
+  for (i = 0; ok && i < 3; i++)
+    ok = burst_is(&bursts[i], 0x60, 9, i);
+  check(ok && burst_is(&bursts[3], 0x60, sizeof buf, 3), "long write sent after the queued bursts");
+  check(sent && pthread_equal(bursts[3].thread, pthread_self()) && returned >= bursts[3].end,
+        "long write sent synchronously by the caller");
+
+  for (i = 0; i < 3; i++) {
+    fill(buf, 9, i);
+    i2c_write(0x18, buf, 9);
+  }
+  i2c_read(0x18, &reg, 1, rd, sizeof rd);
+  check(burst_count == 8 && bursts[7].read && pthread_equal(bursts[7].thread, pthread_self()) &&
+        bursts[7].start >= bursts[6].end, "read sent after the queued bursts");
+}
+
+// a failed queued write only counts in i2c_errors, a synchronous one returns it
+static void test_errors(void)
+{
+  uint8_t buf[I2C_QUEUE_DATA + 4];
+  uint16_t errors = i2c_errors;
+  fill(buf, sizeof buf, 0);
+  fail_count = 1;
+  bool queued = i2c_write(0x70, buf, 9);
+  i2c_flush();
+  check(queued && i2c_errors == errors + 1, "failed queued write counted in i2c_errors");
+  fail_count = 1;
+  check(!i2c_write(0x70, buf, sizeof buf), "failed long write returns false");
+}
+
+// tuning starts at the fastest speed the device is rated for
+static void test_tune(void)
+{
+  static const uint8_t pattern[] = { 0xa5, 0x5a, 0x01, 0xc3 };
+  uint8_t addr;
+  int i, khz = 0, fastest = 0;
+  burst_count = 0;
+  i2c_tune(0x60, 58, pattern, sizeof pattern, 400);
+  for (i = 0; i < burst_count; i++)
+    if (bursts[i].khz > fastest)
+      fastest = bursts[i].khz;
+  for (i = 0; i2c_get_speed(i, &addr) != 0; i++)
+    if (addr == 0x60)
+      khz = i2c_get_speed(i, &addr);
+  check(fastest == 400 && khz == 400, "400 kHz device tuned at 400 kHz");
+  burst_count = 0;
+  i2c_tune(0x50, 0, pattern, sizeof pattern, 1000);
+  check(bursts[0].khz == i2c_speeds[0].khz && i2c_get_speed(1, &addr) == i2c_speeds[0].khz,
+        "Fm+ device tuned at the fastest speed");
+}
+
+/*
+ * Points of a sweep: 3 bursts to the synthesizer, then the work that
+ * does not need them (waiting on the codec). Queued, the bursts
+ * overlap that work.
+ */
+static void bench(void)
+{
+  uint8_t buf[9];
+  int p, i;
+  fill(buf, sizeof buf, 0);
+  double t = now_us();
+  for (p = 0; p < 20; p++) {
+    for (i = 0; i < 3; i++)
+      i2c_transmit(0x60, buf, sizeof buf);
+    chThdSleepMicroseconds(500);
+  }
+  double t_sync = (now_us() - t) / 20;
+  t = now_us();
+  for (p = 0; p < 20; p++) {
+    for (i = 0; i < 3; i++)
+      i2c_write(0x60, buf, sizeof buf);
+    chThdSleepMicroseconds(500);
+  }
+  i2c_flush();
+  double t_async = (now_us() - t) / 20;
+  printf("%d kHz, 3 bursts + 500 us per point: synchronous %.0f us, queued %.0f us\n",
+         bus_khz(), t_sync, t_async);
+}
+
+int main(void)
+{
+  i2c_start();
+  test_tune();
+  test_order();
+  test_flush_waiters();
+  test_sync();
+  test_errors();
+  bench();
+  if (failed)
+    printf("%d FAILED\n", failed);
+  return failed != 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Host test of cell_drawline in plot.c: the clipped runs must set the
+ * same pixels as the per-pixel loop it replaced, copied below, for lines
+ * inside, across and outside the cell. Both are timed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "plot.c"
+
+#define LINES 1000000
+#define BENCH_RUNS 20
+
+// cell_drawline before the clipped runs, less the mutex draw_cell holds now
+static void cell_drawline_old(int w, int h, int x0, int y0, int x1, int y1, int c)
+{
+  uint8_t outcode0 = _compute_outcode(w, h, x0, y0);
+  uint8_t outcode1 = _compute_outcode(w, h, x1, y1);
+
+  if (outcode0 & outcode1) {
+      // this line is out of requested area. early return
+      return;
+  }
+
+  if (x0 > x1) {
+    SWAP(x0, x1);
+    SWAP(y0, y1);
+  }
+
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  int sy = dy > 0 ? 1 : -1;
+  int e = 0;
+
+  dy *= sy;
+
+  if (dx >= dy) {
+      e = dy * 2 - dx;
+      while (x0 != x1) {
+          if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  cell_buffer[y0*w+x0] |= c;
+          x0++;
+          e += dy * 2;
+          if (e >= 0) {
+              e -= dx * 2;
+              y0 += sy;
+          }
+      }
+      if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  cell_buffer[y0*w+x0] |= c;
+  } else {
+      e = dx * 2 - dy;
+      while (y0 != y1) {
+          if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  cell_buffer[y0*w+x0] |= c;
+          y0 += sy;
+          e += dx * 2;
+          if (e >= 0) {
+              e -= dy * 2;
+              x0++;
+          }
+      }
+      if (y0 >= 0 && y0 < h && x0 >= 0 && x0 < w)  cell_buffer[y0*w+x0] |= c;
+  }
+}
+
+static uint16_t expect[CELLWIDTH*CELLHEIGHT];
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// mostly near the cell, some far outside
+static int coord(int size)
+{
+  int r = rand();
+  if (r & 1)
+    return r % (size * 3) - size;
+  return (r >> 1) % 1400 - 700;
+}
+
+typedef struct { int w, h, x0, y0, x1, y1, c; } line_t;
+
+static void random_line(line_t *l)
+{
+  l->w = rand() % 4 ? CELLWIDTH : 1 + rand() % CELLWIDTH;
+  l->h = rand() % 4 ? CELLHEIGHT : 1 + rand() % CELLHEIGHT;
+  l->x0 = coord(l->w);
+  l->y0 = coord(l->h);
+  l->x1 = coord(l->w);
+  l->y1 = coord(l->h);
+  l->c = 1 << (rand() % 16);
+}
+
+static int test_lines(void)
+{
+  line_t l;
+  int i, failed = 0;
+  srand(1);
+  for (i = 0; i < LINES; i++) {
+    random_line(&l);
+    memset(cell_buffer, 0, l.w * l.h * sizeof cell_buffer[0]);
+    cell_drawline_old(l.w, l.h, l.x0, l.y0, l.x1, l.y1, l.c);
+    memcpy(expect, cell_buffer, l.w * l.h * sizeof cell_buffer[0]);
+    memset(cell_buffer, 0, l.w * l.h * sizeof cell_buffer[0]);
+    cell_drawline(l.w, l.h, l.x0, l.y0, l.x1, l.y1, l.c);
+    if (memcmp(expect, cell_buffer, l.w * l.h * sizeof cell_buffer[0]) != 0) {
+      if (failed < 10)
+        printf("mismatch w=%d h=%d (%d,%d)-(%d,%d)\n", l.w, l.h, l.x0, l.y0, l.x1, l.y1);
+      failed++;
+    }
+  }
+  printf("%d lines: %s\n", LINES, failed ? "FAIL" : "ok");
+  return failed;
+}
+
+// lines of a trace crossing the cell, as drawn by draw_cell
+static void bench(void)
+{
+  static line_t lines[10000];
+  int i, r;
+  srand(2);
+  for (i = 0; i < 10000; i++) {
+    lines[i].w = CELLWIDTH;
+    lines[i].h = CELLHEIGHT;
+    lines[i].x0 = rand() % (CELLWIDTH * 2) - CELLWIDTH / 2;
+    lines[i].y0 = rand() % (CELLHEIGHT * 2) - CELLHEIGHT / 2;
+    lines[i].x1 = lines[i].x0 + rand() % 20;
+    lines[i].y1 = rand() % (CELLHEIGHT * 2) - CELLHEIGHT / 2;
+    lines[i].c = 0xffff;
+  }
+  double t = now_us();
+  for (r = 0; r < BENCH_RUNS; r++)
+    for (i = 0; i < 10000; i++)
+      cell_drawline_old(lines[i].w, lines[i].h, lines[i].x0, lines[i].y0, lines[i].x1, lines[i].y1, lines[i].c);
+  double t_old = (now_us() - t) * 1e3 / (BENCH_RUNS * 10000);
+  t = now_us();
+  for (r = 0; r < BENCH_RUNS; r++)
+    for (i = 0; i < 10000; i++)
+      cell_drawline(lines[i].w, lines[i].h, lines[i].x0, lines[i].y0, lines[i].x1, lines[i].y1, lines[i].c);
+  double t_new = (now_us() - t) * 1e3 / (BENCH_RUNS * 10000);
+  printf("per-pixel loop %6.1f ns/line, clipped runs %6.1f ns/line\n", t_old, t_new);
+}
+
+int main(void)
+{
+  int failed = test_lines();
+  bench();
+  return failed != 0;
+}
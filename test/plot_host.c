@@ -0,0 +1,67 @@
+/*
+ * Firmware state and LCD functions plot.c needs on the host. Pixels
+ * sent by ili9341_bulk(_async) and ili9341_fill land in lcd[][].
+ */
+#include <string.h>
+#include "hal.h"
+#include "nanovna.h"
+
+config_t config;
+volatile properties_t current_props;
+volatile properties_t *active_props = &current_props;
+int16_t lastsaveid;
+int8_t previous_marker = -1;
+uint16_t redraw_request;
+int16_t vbat;
+uistat_t uistat;
+float measured[2][POINT_COUNT][2];
+float frequency_error[POINT_COUNT][2];
+float td_zoom_start;
+float td_zoom_stop;
+uint16_t spi_buffer[SPI_BUFFER_SIZE];
+mutex_t mutex_ili9341 = { PTHREAD_MUTEX_INITIALIZER };
+
+uint16_t lcd[LCD_HEIGHT][LCD_WIDTH];
+
+void ili9341_bulk_async(int x, int y, int w, int h, const uint16_t *buf)
+{
+  for (int j = 0; j < h; j++)
+    memcpy(&lcd[y + j][x], &buf[j * w], w * sizeof buf[0]);
+}
+
+void ili9341_bulk(int x, int y, int w, int h)
+{
+  ili9341_bulk_async(x, y, w, h, spi_buffer);
+}
+
+void ili9341_bulk_wait(void)
+{
+}
+
+void ili9341_fill(int x, int y, int w, int h, int color)
+{
+  for (int j = 0; j < h; j++)
+    for (int i = 0; i < w; i++)
+      lcd[y + j][x + i] = color;
+}
+
+void ili9341_drawstring_7x13(const char *str, int x, int y, uint16_t fg, uint16_t bg)
+{
+  (void)str; (void)x; (void)y; (void)fg; (void)bg;
+}
+
+float get_trace_scale(int t)
+{
+  return trace[t].scale;
+}
+
+float get_trace_refpos(int t)
+{
+  return trace[t].refpos;
+}
+
+const char *get_trace_typename(int t)
+{
+  (void)t;
+  return "";
+}
@@ -0,0 +1,191 @@
+/*
+ * Host test of the si5351 planner: si5351_set_frequency_with_offset and
+ * sweeps planned up front then applied point by point must send the same
+ * I2C bytes, and return the same delay, as the driver before the
+ * plan/apply split (si5351_ref.c). Writes to the PLL and multisynth
+ * parameters must cover their whole 8 byte blocks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal.h"
+#include "nanovna.h"
+#include "si5351.h"
+
+#define SWEEPS 2000
+#define POINTS 101
+#define LOG_SIZE 1024
+
+bool si5351_ref_init(void);
+int si5351_ref_set_frequency_with_offset(uint32_t freq, int offset, uint8_t drive_strength);
+
+config_t config;
+bool pll_lock_failed;
+volatile uint16_t i2c_errors;
+I2CDriver I2CD1;
+
+/*
+ * Harmonic rows of main.c. The reference has no 7th/9th harmonic band,
+ * so frequencies stay at or below 5 * harmonic_freq_threshold.
+ */
+static const harmonic_t harmonics[] = {
+  { .rf_harmonic = 1, .lo_harmonic = 1 },
+  { .rf_harmonic = 3, .lo_harmonic = 5 },
+  { .rf_harmonic = 3, .lo_harmonic = 5 },
+  { .rf_harmonic = 5, .lo_harmonic = 7 },
+  { .rf_harmonic = 5, .lo_harmonic = 7 },
+  { .rf_harmonic = 7, .lo_harmonic = 9 },
+  { .rf_harmonic = 7, .lo_harmonic = 9 },
+};
+
+const harmonic_t *get_harmonic(uint32_t freq)
+{
+  uint32_t row = freq ? (freq-1) / config.harmonic_freq_threshold : 0;
+  if (row >= sizeof harmonics / sizeof harmonics[0])
+    row = sizeof harmonics / sizeof harmonics[0] - 1;
+  return &harmonics[row];
+}
+
+// I2C transfers, as 'W'/'R', address, length, bytes
+typedef struct {
+  int len;
+  uint8_t buf[LOG_SIZE];
+} i2c_log_t;
+
+static i2c_log_t *i2c_log;
+
+static void log_transfer(uint8_t type, uint8_t addr, const uint8_t *buf, int len)
+{
+  if (i2c_log->len + 3 + len > LOG_SIZE) {
+    printf("log overflow\n");
+    exit(1);
+  }
+  i2c_log->buf[i2c_log->len++] = type;
+  i2c_log->buf[i2c_log->len++] = addr;
+  i2c_log->buf[i2c_log->len++] = len;
+  memcpy(&i2c_log->buf[i2c_log->len], buf, len);
+  i2c_log->len += len;
+}
+
+// status register reads 0: device ready, PLLs locked
+static void read_status(uint8_t *rx, int rxlen)
+{
+  memset(rx, 0, rxlen);
+}
+
+// current driver
+bool i2c_write(uint8_t addr, const uint8_t *buf, int len)
+{
+  log_transfer('W', addr, buf, len);
+  return true;
+}
+
+bool i2c_read(uint8_t addr, const uint8_t *tx, int txlen, uint8_t *rx, int rxlen)
+{
+  log_transfer('R', addr, tx, txlen);
+  read_status(rx, rxlen);
+  return true;
+}
+
+// bus speed is not modelled
+void i2c_tune(uint8_t addr, uint8_t reg, const uint8_t *data, int len, uint16_t max_khz)
+{
+  (void)addr; (void)reg; (void)data; (void)len; (void)max_khz;
+}
+
+// reference driver
+void i2cAcquireBus(I2CDriver *i2cp) { (void)i2cp; }
+void i2cReleaseBus(I2CDriver *i2cp) { (void)i2cp; }
+
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, uint8_t addr,
+                               const uint8_t *txbuf, size_t txbytes,
+                               uint8_t *rxbuf, size_t rxbytes, sysinterval_t timeout)
+{
+  (void)i2cp;
+  (void)timeout;
+  log_transfer(rxbytes ? 'R' : 'W', addr, txbuf, txbytes);
+  if (rxbytes)
+    read_status(rxbuf, rxbytes);
+  return MSG_OK;
+}
+
+static i2c_log_t ref_log, new_log;
+
+static int compare(const char *what, uint32_t step, int ref_delay, int new_delay)
+{
+  if (ref_log.len == new_log.len && memcmp(ref_log.buf, new_log.buf, ref_log.len) == 0 &&
+      ref_delay == new_delay)
+    return 0;
+  printf("%s %u: %d bytes delay %d, reference %d bytes delay %d\n",
+         what, step, new_log.len, new_delay, ref_log.len, ref_delay);
+  return 1;
+}
+
+// count writes that start or end inside a parameter block
+static int partial_blocks(const i2c_log_t *log)
+{
+  int p, bad = 0;
+  for (p = 0; p < log->len; p += 3 + log->buf[p + 2]) {
+    // registers first .. end-1
+    int first = log->buf[p + 3], end = first + log->buf[p + 2] - 1;
+    if (log->buf[p] != 'W' || end <= SI5351_REG_26_PLL_A || first >= SI5351_REG_58_MULTISYNTH2 + 8)
+      continue;
+    if ((first < SI5351_REG_26_PLL_A ? 0 : (first - SI5351_REG_26_PLL_A) % 8) != 0 ||
+        (end > SI5351_REG_58_MULTISYNTH2 + 8 ? 0 : (end - SI5351_REG_26_PLL_A) % 8) != 0)
+      bad++;
+  }
+  return bad;
+}
+
+int main(void)
+{
+  static si5351_plan_t plan[POINTS];
+  uint32_t freq[POINTS];
+  int s, i, failed = 0, planned = 0, partial = 0;
+
+  config.harmonic_freq_threshold = 300000000;
+  ref_log.len = new_log.len = 0;
+  i2c_log = &ref_log;
+  si5351_ref_init();
+  i2c_log = &new_log;
+  si5351_init();
+  failed += compare("init", 0, 0, 0);
+
+  srand(1);
+  for (s = 0; s < SWEEPS && failed < 10; s++) {
+    if (rand() % 16 == 0)
+      config.harmonic_freq_threshold = rand() % 2 ? 300000000 : 200000000;
+    uint32_t fmax = 5 * config.harmonic_freq_threshold;
+    uint32_t start = 50000 + (uint32_t)((uint64_t)rand() * rand() % (fmax - 50000));
+    uint32_t stop = start + (uint32_t)((uint64_t)rand() * rand() % (fmax - start + 1));
+    int offset = rand() % 4 ? 5000 : rand() % 20000 - 10000;
+    uint8_t drive = rand() & 3;
+    int n = rand() % 2 ? POINTS : 1 + rand() % POINTS;
+    for (i = 0; i < n; i++)
+      freq[i] = n > 1 ? start + (uint64_t)(stop - start) * i / (n - 1) : start;
+
+    // odd sweeps are planned up front as the F303 sweep does
+    int use_plan = s & 1;
+    if (use_plan) {
+      for (i = 0; i < n; i++)
+        si5351_plan_frequency(&plan[i], freq[i], offset, drive);
+      planned += n;
+    }
+    for (i = 0; i < n; i++) {
+      int ref_delay, new_delay;
+      ref_log.len = new_log.len = 0;
+      i2c_log = &ref_log;
+      ref_delay = si5351_ref_set_frequency_with_offset(freq[i], offset, drive);
+      i2c_log = &new_log;
+      if (use_plan)
+        new_delay = si5351_apply_plan(&plan[i]);
+      else
+        new_delay = si5351_set_frequency_with_offset(freq[i], offset, drive);
+      failed += compare(use_plan ? "planned point" : "point", freq[i], ref_delay, new_delay);
+      partial += partial_blocks(&new_log);
+    }
+  }
+  printf("%d sweeps, %d points planned: %s\n", s, planned, failed ? "FAIL" : "ok");
+  printf("writes covering part of a parameter block: %d: %s\n", partial, partial ? "FAIL" : "ok");
+  return failed != 0 || partial != 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Host stand-in for the parts of the ChibiOS kernel API the tested
+ * sources use. Threads, mutexes and semaphores run on pthreads
+ * (ch_host.c), time is in CH_CFG_ST_FREQUENCY ticks of the host clock.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef int32_t msg_t;
+typedef uint32_t systime_t;
+typedef uint32_t sysinterval_t;
+typedef int32_t tprio_t;
+
+#define MSG_OK       0
+#define MSG_TIMEOUT -1
+#define MSG_RESET   -2
+#define TRUE  1
+#define FALSE 0
+#define NORMALPRIO 128
+#define TIME_INFINITE ((sysinterval_t)-1)
+
+#define CH_CFG_ST_FREQUENCY 10000
+#define TIME_MS2I(x) ((sysinterval_t)((x) * (CH_CFG_ST_FREQUENCY / 1000)))
+#define TIME_I2MS(x) ((uint32_t)(x) / (CH_CFG_ST_FREQUENCY / 1000))
+#define TIME_US2I(x) ((sysinterval_t)((x) * CH_CFG_ST_FREQUENCY / 1000000))
+#define TIME_I2US(x) ((uint32_t)(x) * (1000000 / CH_CFG_ST_FREQUENCY))
+
+typedef struct { pthread_mutex_t m; } mutex_t;
+typedef struct { int cnt; unsigned reset; } semaphore_t;
+typedef struct { int cnt; } binary_semaphore_t;
+typedef struct { pthread_t t; } thread_t;
+
+void chSysLock(void);
+void chSysUnlock(void);
+void chSchRescheduleS(void);
+
+void chMtxObjectInit(mutex_t *mp);
+void chMtxLock(mutex_t *mp);
+void chMtxUnlock(mutex_t *mp);
+
+void chSemObjectInit(semaphore_t *sp, int n);
+msg_t chSemWait(semaphore_t *sp);
+msg_t chSemWaitS(semaphore_t *sp);
+void chSemResetI(semaphore_t *sp, int n);
+void chSemSignal(semaphore_t *sp);
+void chSemSignalI(semaphore_t *sp);
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken);
+msg_t chBSemWait(binary_semaphore_t *bsp);
+void chBSemSignal(binary_semaphore_t *bsp);
+void chBSemSignalI(binary_semaphore_t *bsp);
+
+#define THD_WORKING_AREA(s, n) char s[n]
+#define THD_FUNCTION(tname, arg) void tname(void *arg)
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, void (*pf)(void *), void *arg);
+void chRegSetThreadName(const char *name);
+void chThdSleepMilliseconds(uint32_t ms);
+void chThdSleepMicroseconds(uint32_t us);
+
+systime_t chVTGetSystemTime(void);
+systime_t chVTGetSystemTimeX(void);
+#define chTimeAddX(t, i) ((systime_t)((t) + (i)))
+#define chVTIsSystemTimeWithin(start, end) \
+  ((systime_t)(chVTGetSystemTimeX() - (start)) < (systime_t)((end) - (start)))
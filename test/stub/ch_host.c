@@ -0,0 +1,180 @@
+/*
+ * pthread implementation of the stand-in kernel API of ch.h. One big
+ * lock plays the role of chSysLock, semaphores wait on one condition.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include "ch.h"
+
+static pthread_mutex_t sys_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sys_cond = PTHREAD_COND_INITIALIZER;
+
+void chSysLock(void)
+{
+  pthread_mutex_lock(&sys_lock);
+}
+
+void chSysUnlock(void)
+{
+  pthread_mutex_unlock(&sys_lock);
+}
+
+void chSchRescheduleS(void)
+{
+}
+
+void chMtxObjectInit(mutex_t *mp)
+{
+  pthread_mutex_init(&mp->m, NULL);
+}
+
+void chMtxLock(mutex_t *mp)
+{
+  pthread_mutex_lock(&mp->m);
+}
+
+void chMtxUnlock(mutex_t *mp)
+{
+  pthread_mutex_unlock(&mp->m);
+}
+
+void chSemObjectInit(semaphore_t *sp, int n)
+{
+  sp->cnt = n;
+  sp->reset = 0;
+}
+
+// waiters present at a chSemResetI return MSG_RESET
+msg_t chSemWaitS(semaphore_t *sp)
+{
+  unsigned reset = sp->reset;
+  while (sp->cnt <= 0) {
+    pthread_cond_wait(&sys_cond, &sys_lock);
+    if (sp->reset != reset)
+      return MSG_RESET;
+  }
+  sp->cnt--;
+  return MSG_OK;
+}
+
+msg_t chSemWait(semaphore_t *sp)
+{
+  chSysLock();
+  msg_t msg = chSemWaitS(sp);
+  chSysUnlock();
+  return msg;
+}
+
+void chSemResetI(semaphore_t *sp, int n)
+{
+  sp->cnt = n;
+  sp->reset++;
+  pthread_cond_broadcast(&sys_cond);
+}
+
+void chSemSignalI(semaphore_t *sp)
+{
+  sp->cnt++;
+  pthread_cond_broadcast(&sys_cond);
+}
+
+void chSemSignal(semaphore_t *sp)
+{
+  chSysLock();
+  chSemSignalI(sp);
+  chSysUnlock();
+}
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken)
+{
+  bsp->cnt = taken ? 0 : 1;
+}
+
+msg_t chBSemWait(binary_semaphore_t *bsp)
+{
+  chSysLock();
+  while (bsp->cnt == 0)
+    pthread_cond_wait(&sys_cond, &sys_lock);
+  bsp->cnt = 0;
+  chSysUnlock();
+  return MSG_OK;
+}
+
+void chBSemSignalI(binary_semaphore_t *bsp)
+{
+  bsp->cnt = 1;
+  pthread_cond_broadcast(&sys_cond);
+}
+
+void chBSemSignal(binary_semaphore_t *bsp)
+{
+  chSysLock();
+  chBSemSignalI(bsp);
+  chSysUnlock();
+}
+
+static struct {
+  thread_t thd;
+  void (*pf)(void *);
+  void *arg;
+} threads[8];
+static int thread_count;
+
+static void *thread_start(void *p)
+{
+  int i = (int)(intptr_t)p;
+  threads[i].pf(threads[i].arg);
+  return NULL;
+}
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, void (*pf)(void *), void *arg)
+{
+  (void)wsp;
+  (void)size;
+  (void)prio;
+  int i = thread_count++;
+  threads[i].pf = pf;
+  threads[i].arg = arg;
+  pthread_create(&threads[i].thd.t, NULL, thread_start, (void *)(intptr_t)i);
+  pthread_detach(threads[i].thd.t);
+  return &threads[i].thd;
+}
+
+void chRegSetThreadName(const char *name)
+{
+  (void)name;
+}
+
+void chThdSleepMicroseconds(uint32_t us)
+{
+  struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+  nanosleep(&ts, NULL);
+}
+
+void chThdSleepMilliseconds(uint32_t ms)
+{
+  chThdSleepMicroseconds(ms * 1000);
+}
+
+systime_t chVTGetSystemTimeX(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (systime_t)(ts.tv_sec * CH_CFG_ST_FREQUENCY
+                     + ts.tv_nsec / (1000000000 / CH_CFG_ST_FREQUENCY));
+}
+
+systime_t chVTGetSystemTime(void)
+{
+  return chVTGetSystemTimeX();
+}
+
+int chsnprintf(char *str, size_t size, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(str, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
@@ -0,0 +1,3 @@
+#pragma once
+#include <stdarg.h>
+int chsnprintf(char *str, size_t size, const char *fmt, ...);
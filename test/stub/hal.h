@@ -0,0 +1,42 @@
+/*
+ * Host stand-in for the parts of the ChibiOS HAL the tested sources use.
+ * GPIO is ignored, the I2C driver is left to the test that links it.
+ */
+#pragma once
+#include "ch.h"
+
+#define __IO volatile
+
+typedef struct { volatile uint32_t ISR, IER, CR, CFGR, TR, SQR1, DR; } ADC_TypeDef;
+
+#define GPIOA NULL
+#define GPIOB NULL
+#define GPIOC NULL
+#define GPIOC_LED 13
+static inline void palSetPad(void *port, int pad) { (void)port; (void)pad; }
+static inline void palClearPad(void *port, int pad) { (void)port; (void)pad; }
+static inline uint32_t palReadPort(void *port) { (void)port; return 0; }
+
+typedef struct { volatile uint32_t CR1, CR2, OAR1, OAR2, TIMINGR, TIMEOUTR, ISR, ICR, PECR, RXDR, TXDR; } I2C_TypeDef;
+typedef struct { volatile uint32_t CFGR1; } SYSCFG_TypeDef;
+extern SYSCFG_TypeDef *SYSCFG;
+#define SYSCFG_CFGR1_I2C1_FMP (1U << 20)
+#define I2C_CR1_PE (1U << 0)
+
+typedef struct { uint32_t timingr; uint32_t cr1; uint32_t cr2; } I2CConfig;
+typedef struct { I2C_TypeDef *i2c; } I2CDriver;
+extern I2CDriver I2CD1;
+void i2cStart(I2CDriver *i2cp, const I2CConfig *config);
+void i2cStop(I2CDriver *i2cp);
+void i2cAcquireBus(I2CDriver *i2cp);
+void i2cReleaseBus(I2CDriver *i2cp);
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, uint8_t addr,
+                               const uint8_t *txbuf, size_t txbytes,
+                               uint8_t *rxbuf, size_t rxbytes,
+                               sysinterval_t timeout);
+
+#define STM32_TIMINGR_PRESC(n)  ((n) << 28)
+#define STM32_TIMINGR_SCLDEL(n) ((n) << 20)
+#define STM32_TIMINGR_SDADEL(n) ((n) << 16)
+#define STM32_TIMINGR_SCLH(n)   ((n) << 8)
+#define STM32_TIMINGR_SCLL(n)   ((n) << 0)
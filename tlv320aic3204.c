@@ -22,9 +22,12 @@
 
 #define REFCLK_8000KHZ
 #define AIC3204_ADDR 0x18
+#define AIC3204_I2C_MAX_KHZ 400    // datasheet: fast mode
 
 #define wait_ms(ms)     chThdSleepMilliseconds(ms)
 
+#include <string.h>
+
 static const uint8_t conf_data_pll[] = {
   // len, ( reg, data ), 
   2, 0x00, 0x00, /* Initialize to Page 0 */
@@ -88,43 +91,165 @@ static const uint8_t conf_data_unmute[] = {
 
 static void tlv320aic3204_bulk_write(const uint8_t *buf, int len)
 {
-  int addr = AIC3204_ADDR;
-  i2cAcquireBus(&I2CD1);
-  (void)i2cMasterTransmitTimeout(&I2CD1, addr, buf, len, NULL, 0, 1000);
-  i2cReleaseBus(&I2CD1);
+  (void)i2c_write(AIC3204_ADDR, buf, len);
 }
 
 #if 0
 static int tlv320aic3204_read(uint8_t d0)
 {
-  int addr = AIC3204_ADDR;
   uint8_t buf[] = { d0 };
-  i2cAcquireBus(&I2CD1);
-  i2cMasterTransmitTimeout(&I2CD1, addr, buf, 1, buf, 1, 1000);
-  i2cReleaseBus(&I2CD1);
+  i2c_read(AIC3204_ADDR, buf, 1, buf, 1);
   return buf[0];
 }
 #endif
 
+/*
+ * Shadow of pages 0 and 1. Page select goes out only when the page
+ * changes, unchanged registers are skipped and changes to consecutive
+ * registers are sent as one auto-increment burst. Software reset or a
+ * failed i2c write drops the shadow. Sweep and shell threads both write,
+ * aic3204_mutex keeps each config sequence, shadow and burst together.
+ */
+#define AIC3204_PAGES 2
+#define AIC3204_REGS  128
+static uint8_t aic3204_page = 0xff;   // unknown
+static uint8_t aic3204_reg[AIC3204_PAGES][AIC3204_REGS];
+static uint8_t aic3204_valid[AIC3204_PAGES][AIC3204_REGS/8];
+static uint16_t aic3204_i2c_errors;
+static uint8_t aic3204_burst[16];
+static int aic3204_burst_len = 0;
+static mutex_t aic3204_mutex;
+
+static void tlv320aic3204_flush(void)
+{
+  if (aic3204_burst_len > 1)
+    tlv320aic3204_bulk_write(aic3204_burst, aic3204_burst_len);
+  aic3204_burst_len = 0;
+}
+
+static void tlv320aic3204_write(uint8_t reg, uint8_t data)
+{
+  uint8_t page = aic3204_page;
+  if (reg == 0x00) {
+    if (data == page)
+      return;
+    tlv320aic3204_flush();
+    aic3204_burst[0] = reg;
+    aic3204_burst[1] = data;
+    tlv320aic3204_bulk_write(aic3204_burst, 2);
+    aic3204_page = data;
+    return;
+  }
+  if (page == 0 && reg == 0x01) {
+    // software reset
+    tlv320aic3204_flush();
+    aic3204_burst[0] = reg;
+    aic3204_burst[1] = data;
+    tlv320aic3204_bulk_write(aic3204_burst, 2);
+    memset(aic3204_valid, 0, sizeof aic3204_valid);
+    return;
+  }
+  if (page < AIC3204_PAGES && reg < AIC3204_REGS) {
+    uint8_t bit = 1 << (reg & 7);
+    if ((aic3204_valid[page][reg>>3] & bit) && aic3204_reg[page][reg] == data)
+      return;
+    aic3204_reg[page][reg] = data;
+    aic3204_valid[page][reg>>3] |= bit;
+  }
+  if (aic3204_burst_len > 1 && aic3204_burst[0] + aic3204_burst_len - 1 == reg
+      && aic3204_burst_len < (int)sizeof aic3204_burst) {
+    aic3204_burst[aic3204_burst_len++] = data;
+    return;
+  }
+  tlv320aic3204_flush();
+  aic3204_burst[0] = reg;
+  aic3204_burst[1] = data;
+  aic3204_burst_len = 2;
+}
+
 static void tlv320aic3204_config(const uint8_t *data)
 {
   const uint8_t *p = data;
+  chMtxLock(&aic3204_mutex);
+  if (aic3204_i2c_errors != i2c_errors) {
+    aic3204_i2c_errors = i2c_errors;
+    aic3204_page = 0xff;
+    memset(aic3204_valid, 0, sizeof aic3204_valid);
+  }
   while (*p) {
     uint8_t len = *p++;
-    tlv320aic3204_bulk_write(p, len);
+    for (int i = 1; i < len; i++)
+      tlv320aic3204_write(p[0] + i - 1, p[i]);
     p += len;
   }
+  tlv320aic3204_flush();
+  chMtxUnlock(&aic3204_mutex);
 }
 
 void tlv320aic3204_init(void)
 {
+  // speed test on NDAC/MDAC, reset by conf_data_pll afterwards
+  static const uint8_t page0[] = { 0x00, 0x00 };
+  static const uint8_t tune_pattern[] = { 0x55, 0x2a };
+  chMtxObjectInit(&aic3204_mutex);
+  tlv320aic3204_bulk_write(page0, sizeof page0);
+  i2c_tune(AIC3204_ADDR, 0x0b, tune_pattern, sizeof tune_pattern, AIC3204_I2C_MAX_KHZ);
   tlv320aic3204_config(conf_data_pll);
   tlv320aic3204_config(conf_data_clk);
   tlv320aic3204_config(conf_data_routing);
+  i2c_flush();
   wait_ms(40);
   tlv320aic3204_config(conf_data_unmute);
 }
 
+#ifdef __CODEC_PROFILE__
+/*
+ * Sample rate profiles. NADC/MADC and NDAC/MDAC stay at 2/7, the rate
+ * comes from the oversampling ratios with the ADC decimation filter each
+ * ratio allows. The DAC stays powered down, its dividers only make WCLK,
+ * and BCLK is kept at 32fs. Processing blocks change only with the ADC
+ * powered down.
+ */
+static const uint8_t conf_data_rate[CODEC_PROFILES][23] = {
+  { // 48kHz
+    2, 0x00, 0x00, /* Select Page 0 */
+    2, 0x51, 0x00, /* Power down ADC */
+    3, 0x0d, 0x00, 0x80, /* DOSR 128 */
+    2, 0x1e, 0x80 + 28, /* BCLKN 28 */
+    2, 0x14, 0x80, /* AOSR 128 */
+    2, 0x3d, 0x01, /* ADC PRB_R1, filter A */
+    2, 0x51, 0xc0, /* Power up ADC */
+    0 // sentinel
+  },
+  { // 96kHz
+    2, 0x00, 0x00, /* Select Page 0 */
+    2, 0x51, 0x00, /* Power down ADC */
+    3, 0x0d, 0x00, 0x40, /* DOSR 64 */
+    2, 0x1e, 0x80 + 14, /* BCLKN 14 */
+    2, 0x14, 0x40, /* AOSR 64 */
+    2, 0x3d, 0x07, /* ADC PRB_R7, filter B */
+    2, 0x51, 0xc0, /* Power up ADC */
+    0 // sentinel
+  },
+  { // 192kHz
+    2, 0x00, 0x00, /* Select Page 0 */
+    2, 0x51, 0x00, /* Power down ADC */
+    3, 0x0d, 0x00, 0x20, /* DOSR 32 */
+    2, 0x1e, 0x80 + 7, /* BCLKN 7 */
+    2, 0x14, 0x20, /* AOSR 32 */
+    2, 0x3d, 0x0d, /* ADC PRB_R13, filter C */
+    2, 0x51, 0xc0, /* Power up ADC */
+    0 // sentinel
+  },
+};
+
+// profile 0, 1, 2: 48kHz << profile
+void tlv320aic3204_set_rate(int profile)
+{
+  tlv320aic3204_config(conf_data_rate[profile]);
+}
+#endif
+
 void tlv320aic3204_select(int channel)
 {
     const uint8_t ch3[] = {
@@ -255,6 +255,9 @@ static const menuitem_t menu_transform_window[] = {
   MENUITEM_FUNC("MINIMUM",      menu_transform_window_cb),
   MENUITEM_FUNC("NORMAL",       menu_transform_window_cb),
   MENUITEM_FUNC("MAXIMUM",      menu_transform_window_cb),
+  MENUITEM_FUNC("HANN",         menu_transform_window_cb),
+  MENUITEM_FUNC("\2BLACKMAN\0HARRIS", menu_transform_window_cb),
+  MENUITEM_FUNC("\2KAISER\0USER BETA", menu_transform_window_cb),
   MENUITEM_BACK,
   MENUITEM_END
 };
@@ -790,6 +793,7 @@ static void menu_cal2_cb(int item)
   switch (item) {
   case 2: // RESET
     cal_status = 0;
+    cal_segments = 0;
     break;
   case 3: // CORRECTION
     // toggle applying correction
@@ -808,9 +812,11 @@ static void menu_recall_cb(int item)
   if (item < 0 || item >= 5)
     return;
   if (caldata_recall(item) == 0) {
+    cal_segments = 0;
+    // the recalled span and points, replans the sweep
+    update_frequencies();
     menu_move_back();
     ui_mode_normal();
-    update_grid();
     draw_cal_status();
   }
 }
@@ -990,6 +996,18 @@ static void menu_transform_window_cb(int item)
       domain_mode = (domain_mode & ~TD_WINDOW) | TD_WINDOW_MAXIMUM;
       ui_mode_normal();
       break;
+  case 3: // HANN
+      domain_mode = (domain_mode & ~TD_WINDOW) | TD_WINDOW_HANN;
+      ui_mode_normal();
+      break;
+  case 4: // 2BLACKMAN 0HARRIS
+      domain_mode = (domain_mode & ~TD_WINDOW) | TD_WINDOW_BLACKMAN_HARRIS;
+      ui_mode_normal();
+      break;
+  case 5: // 2KAISER 0USER BETA
+      domain_mode = (domain_mode & ~TD_WINDOW) | TD_WINDOW_KAISER;
+      ui_mode_normal();
+      break;
   }
 }
 
@@ -1120,7 +1138,8 @@ menu_marker_op_cb(int item)
         int32_t center = get_sweep_frequency(ST_CENTER);
         int32_t span = center - freq;
         if (span < 0) span = -span;
-        set_sweep_frequency(ST_SPAN, span * 2);
+        // span * 2 may pass int32, set_sweep_frequency clamps it
+        set_sweep_frequency(ST_SPAN, span > INT32_MAX/2 ? INT32_MAX : span * 2);
       } else {
         // if 2 or more marker active, set start and stop freq to each marker
         int32_t freq2 = get_marker_frequency(previous_marker);
@@ -1538,6 +1557,9 @@ static void menu_item_modify_attribute(
       if ((item == 0 && (domain_mode & TD_WINDOW) == TD_WINDOW_MINIMUM)
        || (item == 1 && (domain_mode & TD_WINDOW) == TD_WINDOW_NORMAL)
        || (item == 2 && (domain_mode & TD_WINDOW) == TD_WINDOW_MAXIMUM)
+       || (item == 3 && (domain_mode & TD_WINDOW) == TD_WINDOW_HANN)
+       || (item == 4 && (domain_mode & TD_WINDOW) == TD_WINDOW_BLACKMAN_HARRIS)
+       || (item == 5 && (domain_mode & TD_WINDOW) == TD_WINDOW_KAISER)
        ) {
         *bg = 0x0000;
         *fg = 0xffff;
@@ -1576,8 +1598,14 @@ static void draw_menu_buttons(const menuitem_t *menu)
       ili9341_drawstring_5x7(menu[i].label, LCD_WIDTH-54, y+12, fg, bg);
     }
 
+#else
+#ifdef __LCD_ASYNC__
+    // first label glyph is prepared while button is filled, the
+    // following glyphs are sent after the fill completes
+    ili9341_fill_async(LCD_WIDTH-90, y, 90, 40, bg);
 #else
     ili9341_fill(LCD_WIDTH-90, y, 90, 40, bg);
+#endif
 
         menu_item_modify_attribute(menu, i, &fg, &bg);
         if (menu_is_multiline(menu[i].label, &l1, &l2)) {